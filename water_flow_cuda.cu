@@ -0,0 +1,230 @@
+// CUDA backend for the simulation kernels. The dye and velocity fields stay
+// resident on the device across steps; only the 8-bit RGB frame is copied
+// back per step. Compiled when WATER_FLOW_USE_CUDA is ON and selected at
+// runtime with --backend=cuda.
+
+#include <cmath>
+#include <cstdio>
+
+#include <cuda_runtime.h>
+
+#include "water_flow_cuda.h"
+
+namespace {
+
+constexpr int kBlock = 16;
+constexpr int kMaxBlurRadius = 64;
+
+__constant__ float dBlurKernel[2 * kMaxBlurRadius + 1];
+
+__device__ float streamFunctionDev(float x, float y, float t) {
+    constexpr float pi = 3.14159265358979323846f;
+    const float base = sinf(2.0f * pi * (3.0f * x + 0.7f * t)) * sinf(2.0f * pi * (3.0f * y - 0.5f * t));
+    const float swirl = cosf(2.0f * pi * (2.0f * x - 0.3f * t)) * cosf(2.0f * pi * (2.0f * y + 0.4f * t));
+    const float ripple = sinf(2.0f * pi * (4.0f * x + y + 0.2f * t));
+    return base + 0.6f * swirl + 0.25f * ripple;
+}
+
+__global__ void psiKernel(float* psi, int n, float t) {
+    const int x = blockIdx.x * blockDim.x + threadIdx.x;
+    const int y = blockIdx.y * blockDim.y + threadIdx.y;
+    if (x >= n || y >= n) {
+        return;
+    }
+    psi[y * n + x] = streamFunctionDev(static_cast<float>(x) / n, static_cast<float>(y) / n, t);
+}
+
+__global__ void velocityKernel(const float* psi, float* velocity, int n, float scale) {
+    const int x = blockIdx.x * blockDim.x + threadIdx.x;
+    const int y = blockIdx.y * blockDim.y + threadIdx.y;
+    if (x >= n || y >= n) {
+        return;
+    }
+    const int xp = min(x + 1, n - 1);
+    const int xm = max(x - 1, 0);
+    const int yp = min(y + 1, n - 1);
+    const int ym = max(y - 1, 0);
+    const float dpsi_dx = psi[y * n + xp] - psi[y * n + xm];
+    const float dpsi_dy = psi[yp * n + x] - psi[ym * n + x];
+    const int idx = y * n + x;
+    velocity[2 * idx + 0] = dpsi_dy * scale;
+    velocity[2 * idx + 1] = -dpsi_dx * scale;
+}
+
+__global__ void blurHorizontalKernel(const float* src, float* dst, int n, int radius) {
+    const int x = blockIdx.x * blockDim.x + threadIdx.x;
+    const int y = blockIdx.y * blockDim.y + threadIdx.y;
+    if (x >= n || y >= n) {
+        return;
+    }
+    float accumU = 0.0f;
+    float accumV = 0.0f;
+    for (int k = -radius; k <= radius; ++k) {
+        const int xi = min(max(x + k, 0), n - 1);
+        const float w = dBlurKernel[k + radius];
+        accumU += src[2 * (y * n + xi) + 0] * w;
+        accumV += src[2 * (y * n + xi) + 1] * w;
+    }
+    dst[2 * (y * n + x) + 0] = accumU;
+    dst[2 * (y * n + x) + 1] = accumV;
+}
+
+__global__ void blurVerticalKernel(const float* src, float* dst, int n, int radius) {
+    const int x = blockIdx.x * blockDim.x + threadIdx.x;
+    const int y = blockIdx.y * blockDim.y + threadIdx.y;
+    if (x >= n || y >= n) {
+        return;
+    }
+    float accumU = 0.0f;
+    float accumV = 0.0f;
+    for (int k = -radius; k <= radius; ++k) {
+        const int yi = min(max(y + k, 0), n - 1);
+        const float w = dBlurKernel[k + radius];
+        accumU += src[2 * (yi * n + x) + 0] * w;
+        accumV += src[2 * (yi * n + x) + 1] * w;
+    }
+    dst[2 * (y * n + x) + 0] = accumU;
+    dst[2 * (y * n + x) + 1] = accumV;
+}
+
+// Fused advect + blend toward baseDye + clamp + 8-bit pack, one pass.
+__global__ void advectBlendKernel(const float* dye, const float* baseDye, const float* velocity,
+                                  float* dyeOut, unsigned char* rgb, int n, float dt, float blendKeep) {
+    const int x = blockIdx.x * blockDim.x + threadIdx.x;
+    const int y = blockIdx.y * blockDim.y + threadIdx.y;
+    if (x >= n || y >= n) {
+        return;
+    }
+    const int idx = y * n + x;
+    const size_t planeSize = static_cast<size_t>(n) * n;
+
+    float xBack = static_cast<float>(x) - dt * velocity[2 * idx + 0];
+    float yBack = static_cast<float>(y) - dt * velocity[2 * idx + 1];
+    xBack = fminf(fmaxf(xBack, 0.0f), static_cast<float>(n - 1));
+    yBack = fminf(fmaxf(yBack, 0.0f), static_cast<float>(n - 1));
+    const int x0 = static_cast<int>(xBack);
+    const int y0 = static_cast<int>(yBack);
+    const int x1 = min(x0 + 1, n - 1);
+    const int y1 = min(y0 + 1, n - 1);
+    const float fx = xBack - static_cast<float>(x0);
+    const float fy = yBack - static_cast<float>(y0);
+
+    for (int c = 0; c < 3; ++c) {
+        const float* src = dye + c * planeSize;
+        const float top = src[y0 * n + x0] * (1.0f - fx) + src[y0 * n + x1] * fx;
+        const float bottom = src[y1 * n + x0] * (1.0f - fx) + src[y1 * n + x1] * fx;
+        const float advected = top * (1.0f - fy) + bottom * fy;
+        const float blended = blendKeep * advected + (1.0f - blendKeep) * baseDye[c * planeSize + idx];
+        dyeOut[c * planeSize + idx] = blended;
+        rgb[3 * idx + c] = static_cast<unsigned char>(fminf(fmaxf(blended, 0.0f), 255.0f));
+    }
+}
+
+bool check(cudaError_t err, const char* what) {
+    if (err == cudaSuccess) {
+        return true;
+    }
+    std::fprintf(stderr, "CUDA error in %s: %s\n", what, cudaGetErrorString(err));
+    return false;
+}
+
+}  // namespace
+
+struct CudaSimContext {
+    int n = 0;
+    float strength = 0.0f;
+    float dt = 0.0f;
+    int blurRadius = 0;
+    float* psi = nullptr;
+    float* velocity = nullptr;
+    float* velocityTemp = nullptr;
+    float* dye = nullptr;
+    float* dyeTemp = nullptr;
+    float* baseDye = nullptr;
+    unsigned char* rgb = nullptr;
+};
+
+bool cudaBackendAvailable() {
+    int deviceCount = 0;
+    return cudaGetDeviceCount(&deviceCount) == cudaSuccess && deviceCount > 0;
+}
+
+CudaSimContext* cudaSimCreate(int n, float strength, float dt, float blurSigma, const float* initialDye) {
+    CudaSimContext* ctx = new CudaSimContext();
+    ctx->n = n;
+    ctx->strength = strength;
+    ctx->dt = dt;
+
+    const size_t planeSize = static_cast<size_t>(n) * n;
+    bool ok = check(cudaMalloc(&ctx->psi, planeSize * sizeof(float)), "cudaMalloc psi") &&
+              check(cudaMalloc(&ctx->velocity, planeSize * 2 * sizeof(float)), "cudaMalloc velocity") &&
+              check(cudaMalloc(&ctx->velocityTemp, planeSize * 2 * sizeof(float)), "cudaMalloc velocityTemp") &&
+              check(cudaMalloc(&ctx->dye, planeSize * 3 * sizeof(float)), "cudaMalloc dye") &&
+              check(cudaMalloc(&ctx->dyeTemp, planeSize * 3 * sizeof(float)), "cudaMalloc dyeTemp") &&
+              check(cudaMalloc(&ctx->baseDye, planeSize * 3 * sizeof(float)), "cudaMalloc baseDye") &&
+              check(cudaMalloc(&ctx->rgb, planeSize * 3), "cudaMalloc rgb");
+    if (ok) {
+        ok = check(cudaMemcpy(ctx->dye, initialDye, planeSize * 3 * sizeof(float), cudaMemcpyHostToDevice), "upload dye") &&
+             check(cudaMemcpy(ctx->baseDye, initialDye, planeSize * 3 * sizeof(float), cudaMemcpyHostToDevice), "upload baseDye");
+    }
+
+    if (ok && blurSigma > 0.0f) {
+        const int radius = std::min(kMaxBlurRadius, std::max(1, static_cast<int>(blurSigma * 3.0f)));
+        float kernel[2 * kMaxBlurRadius + 1];
+        float sum = 0.0f;
+        for (int i = -radius; i <= radius; ++i) {
+            kernel[i + radius] = std::exp(-(i * i) / (2.0f * blurSigma * blurSigma));
+            sum += kernel[i + radius];
+        }
+        for (int i = 0; i <= 2 * radius; ++i) {
+            kernel[i] /= sum;
+        }
+        ctx->blurRadius = radius;
+        ok = check(cudaMemcpyToSymbol(dBlurKernel, kernel, (2 * radius + 1) * sizeof(float)), "upload blur kernel");
+    }
+
+    if (!ok) {
+        cudaSimDestroy(ctx);
+        return nullptr;
+    }
+    return ctx;
+}
+
+bool cudaSimStep(CudaSimContext* ctx, float t, float blendKeep, unsigned char* rgbOut) {
+    const int n = ctx->n;
+    const size_t planeSize = static_cast<size_t>(n) * n;
+    const dim3 block(kBlock, kBlock);
+    const dim3 grid((n + kBlock - 1) / kBlock, (n + kBlock - 1) / kBlock);
+    const float scale = ctx->strength * static_cast<float>(n) * 0.5f;
+
+    psiKernel<<<grid, block>>>(ctx->psi, n, t);
+    velocityKernel<<<grid, block>>>(ctx->psi, ctx->velocity, n, scale);
+    if (ctx->blurRadius > 0) {
+        blurHorizontalKernel<<<grid, block>>>(ctx->velocity, ctx->velocityTemp, n, ctx->blurRadius);
+        blurVerticalKernel<<<grid, block>>>(ctx->velocityTemp, ctx->velocity, n, ctx->blurRadius);
+    }
+    advectBlendKernel<<<grid, block>>>(ctx->dye, ctx->baseDye, ctx->velocity, ctx->dyeTemp, ctx->rgb, n, ctx->dt, blendKeep);
+    std::swap(ctx->dye, ctx->dyeTemp);
+
+    return check(cudaMemcpy(rgbOut, ctx->rgb, planeSize * 3, cudaMemcpyDeviceToHost), "download rgb") &&
+           check(cudaGetLastError(), "kernel launch");
+}
+
+bool cudaSimDownloadDye(CudaSimContext* ctx, float* dyeOut) {
+    const size_t planeSize = static_cast<size_t>(ctx->n) * ctx->n;
+    return check(cudaMemcpy(dyeOut, ctx->dye, planeSize * 3 * sizeof(float), cudaMemcpyDeviceToHost), "download dye");
+}
+
+void cudaSimDestroy(CudaSimContext* ctx) {
+    if (ctx == nullptr) {
+        return;
+    }
+    cudaFree(ctx->psi);
+    cudaFree(ctx->velocity);
+    cudaFree(ctx->velocityTemp);
+    cudaFree(ctx->dye);
+    cudaFree(ctx->dyeTemp);
+    cudaFree(ctx->baseDye);
+    cudaFree(ctx->rgb);
+    delete ctx;
+}
@@ -0,0 +1,21 @@
+// Host interface to the CUDA simulation backend (water_flow_cuda.cu).
+// Only compiled in when WATER_FLOW_USE_CUDA is ON.
+#pragma once
+
+struct CudaSimContext;
+
+// True if at least one CUDA device is usable.
+bool cudaBackendAvailable();
+
+// Allocates device state, uploads the initial (planar) dye field, and
+// prepares the blur kernel. Returns nullptr on failure (already reported).
+CudaSimContext* cudaSimCreate(int n, float strength, float dt, float blurSigma, const float* initialDye);
+
+// Runs one full step (velocity build, blur, fused advect/blend/convert) and
+// copies the packed RGB8 frame into rgbOut.
+bool cudaSimStep(CudaSimContext* ctx, float t, float blendKeep, unsigned char* rgbOut);
+
+// Copies the current dye planes back to the host (checkpointing).
+bool cudaSimDownloadDye(CudaSimContext* ctx, float* dyeOut);
+
+void cudaSimDestroy(CudaSimContext* ctx);
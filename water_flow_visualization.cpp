@@ -1,19 +1,68 @@
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <condition_variable>
+#include <deque>
 #include <cstdint>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <random>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 #include <Magick++.h>
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define WATER_FLOW_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
 #ifdef USE_OPENCV
 #include <opencv2/highgui.hpp>
 #include <opencv2/imgproc.hpp>
 #endif
 
+#ifdef USE_CUDA
+#include "water_flow_cuda.h"
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+// One --emitter=x,y,r,color,rate source: pixels within `radius` of (x, y)
+// are blended toward `color` by `rate` (scaled by a rim falloff) after each
+// advection step.
+struct Emitter {
+    int x = 0;
+    int y = 0;
+    int radius = 0;
+    unsigned color = 0xFFFFFF;  // RRGGBB
+    float rate = 0.1f;
+};
+
 struct Config {
     int resolution = 512;
     int steps = 180;
@@ -23,295 +72,4201 @@ struct Config {
     std::string gifName = "water_flow.gif";
     bool liveView = true;
     int fps = 60;
+    int threads = 0;  // 0 = one worker per hardware thread
+    bool pinThreads = false;  // --pin-threads: pin workers to cores so first-touch pages stay local
+    bool fastMath = false;  // --precision=fast: polynomial sin/cos for psi
+    bool streamOutput = false;  // --output-mode=streaming: encode frames as they are produced
+    std::string outputFormat = "gif";  // gif | raw | delta
+    std::string decodeDeltaPath;  // --decode-delta=file: expand a delta stream to raw frames
+    std::string backend = "cpu";  // cpu | cuda (needs WATER_FLOW_USE_CUDA)
+    int checkpointEvery = 0;  // write a state snapshot every K steps (0 = off)
+    std::string resumePath;  // continue from a snapshot written by --checkpoint-every
+    int frameBegin = 0;  // --frames=start:end: emit only this slice of the --steps timeline
+    int frameEnd = -1;  // exclusive; -1 = --steps. Steps before `start` are replayed, not emitted.
+    std::vector<std::string> mergePaths;  // --merge=seg1,seg2,...: concatenate shard outputs and exit
+    int velocityUpdateEvery = 1;  // rebuild the velocity field every K steps, interpolate between
+    std::string velocityCachePath;  // --velocity-cache=file: reuse blurred velocity fields across runs
+    float blurSigma = 1.0f;
+    bool boxBlur = false;  // --blur-mode=box: three-pass running-sum approximation
+    float vorticity = 0.0f;  // --vorticity=eps: confinement strength, 0 = off
+    int velocityScale = 1;  // simulate velocity on an n/K grid, upsample for advection
+    bool tileSkip = false;  // --tile-skip: stop recomputing converged 32x32 dye tiles
+    bool maccormack = false;  // --advect=maccormack: error-compensated two-pass advection
+    int roiX = 0;  // --roi=x,y,w,h: render only this crop, simulate its dependency cone
+    int roiY = 0;
+    int roiW = 0;  // 0 = no ROI, render the full domain
+    int roiH = 0;
+    std::vector<Emitter> emitters;  // --emitter=x,y,r,color,rate, repeatable
+    bool wrapBoundary = false;  // --boundary=wrap: periodic borders, output tiles seamlessly
+    std::string sweepPath;  // --sweep=file: render every variant listed in the file
+    bool fp16Storage = false;  // --storage=fp16: keep field buffers in half precision
+    bool profile = false;  // print a per-stage timing breakdown at exit
+    std::string tracePath;  // --trace=file: write Chrome trace-event JSON with per-stage zones
+    bool bench = false;  // run the kernel benchmark matrix instead of rendering
+    bool verify = false;  // compare the optimized kernels against the scalar reference
+    bool checksum = false;  // print a per-frame FNV-1a checksum of the packed RGB
+    std::vector<int> benchResolutions = {256, 512, 1024, 2048, 4096};
 };
 
-static float streamFunction(float x, float y, float t) {
-    constexpr float pi = 3.14159265358979323846f;
-    const float base = std::sin(2.0f * pi * (3.0f * x + 0.7f * t)) * std::sin(2.0f * pi * (3.0f * y - 0.5f * t));
-    const float swirl = std::cos(2.0f * pi * (2.0f * x - 0.3f * t)) * std::cos(2.0f * pi * (2.0f * y + 0.4f * t));
-    const float ripple = std::sin(2.0f * pi * (4.0f * x + y + 0.2f * t));
-    return base + 0.6f * swirl + 0.25f * ripple;
-}
-
-static void buildVelocityField(const Config& cfg, float t, std::vector<float>& velocity) {
-    const int n = cfg.resolution;
-    std::vector<float> psi(n * n);
-    for (int y = 0; y < n; ++y) {
-        for (int x = 0; x < n; ++x) {
-            const float fx = static_cast<float>(x) / static_cast<float>(n);
-            const float fy = static_cast<float>(y) / static_cast<float>(n);
-            psi[y * n + x] = streamFunction(fx, fy, t);
+// Persistent worker pool that splits a row range into one contiguous band per
+// worker. Band boundaries depend only on the range and the thread count, so
+// repeated runs produce identical results regardless of scheduling.
+class ThreadPool {
+public:
+    // With pinThreads, worker i (including the caller as worker 0) is pinned
+    // to core i. Combined with the deterministic band split this gives a
+    // stable row-to-core mapping across every stage of every step, so pages
+    // first-touched by a band's worker stay local to it on NUMA machines.
+    // Pinning is Linux-only; elsewhere the flag is a no-op.
+    explicit ThreadPool(int threadCount, bool pinThreads = false) : pin_(pinThreads) {
+        int count = threadCount > 0 ? threadCount : static_cast<int>(std::thread::hardware_concurrency());
+        count = std::max(1, count);
+        if (pin_) {
+            pinToCore(0);
         }
+        // Worker 0 is the calling thread; only spawn the extras.
+        for (int i = 1; i < count; ++i) {
+            workers_.emplace_back([this, i] { workerLoop(i); });
+        }
+        bandCount_ = count;
     }
 
-    velocity.resize(n * n * 2);
-    const float scale = cfg.strength * static_cast<float>(n) * 0.5f;
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
 
-    for (int y = 0; y < n; ++y) {
-        for (int x = 0; x < n; ++x) {
-            const int idx = y * n + x;
-            const int xp = std::min(x + 1, n - 1);
-            const int xm = std::max(x - 1, 0);
-            const int yp = std::min(y + 1, n - 1);
-            const int ym = std::max(y - 1, 0);
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+            ++generation_;
+        }
+        wake_.notify_all();
+        for (std::thread& worker : workers_) {
+            worker.join();
+        }
+    }
 
-            const float dpsi_dx = (psi[y * n + xp] - psi[y * n + xm]);
-            const float dpsi_dy = (psi[yp * n + x] - psi[ym * n + x]);
+    int threadCount() const { return bandCount_; }
 
-            velocity[2 * idx + 0] = dpsi_dy * scale;
-            velocity[2 * idx + 1] = -dpsi_dx * scale;
+    // Runs body(rowBegin, rowEnd) on every worker for its band of [begin, end)
+    // and returns once all bands are done.
+    void parallelFor(int begin, int end, const std::function<void(int, int)>& body) {
+        if (end <= begin) {
+            return;
+        }
+        if (bandCount_ == 1 || end - begin == 1) {
+            body(begin, end);
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            rangeBegin_ = begin;
+            rangeEnd_ = end;
+            body_ = &body;
+            pending_ = bandCount_ - 1;
+            ++generation_;
         }
+        wake_.notify_all();
+        runBand(0, begin, end, body);
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this] { return pending_ == 0; });
+        body_ = nullptr;
     }
-}
 
-static void gaussianBlur(std::vector<float>& data, int width, int height, int channels, float sigma) {
-    if (sigma <= 0.0f) {
-        return;
-    }
-    const int radius = std::max(1, static_cast<int>(sigma * 3.0f));
-    const int kernelSize = 2 * radius + 1;
-    std::vector<float> kernel(kernelSize);
-    float sum = 0.0f;
-    for (int i = -radius; i <= radius; ++i) {
-        const float value = std::exp(-(i * i) / (2.0f * sigma * sigma));
-        kernel[i + radius] = value;
-        sum += value;
-    }
-    for (float& v : kernel) {
-        v /= sum;
+private:
+    void runBand(int band, int begin, int end, const std::function<void(int, int)>& body) const {
+        const int total = end - begin;
+        const int bandBegin = begin + static_cast<int>(static_cast<int64_t>(total) * band / bandCount_);
+        const int bandEnd = begin + static_cast<int>(static_cast<int64_t>(total) * (band + 1) / bandCount_);
+        if (bandBegin < bandEnd) {
+            body(bandBegin, bandEnd);
+        }
     }
 
-    std::vector<float> temp(data.size());
+    static void pinToCore(int core) {
+#ifdef __linux__
+        const int cores = std::max(1u, std::thread::hardware_concurrency());
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core % cores, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+        (void)core;
+#endif
+    }
 
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            for (int c = 0; c < channels; ++c) {
-                float accum = 0.0f;
-                for (int k = -radius; k <= radius; ++k) {
-                    const int xi = std::clamp(x + k, 0, width - 1);
-                    accum += data[(y * width + xi) * channels + c] * kernel[k + radius];
+    void workerLoop(int band) {
+        if (pin_) {
+            pinToCore(band);
+        }
+        uint64_t seenGeneration = 0;
+        for (;;) {
+            const std::function<void(int, int)>* body = nullptr;
+            int begin = 0;
+            int end = 0;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [&] { return generation_ != seenGeneration; });
+                seenGeneration = generation_;
+                if (stopping_) {
+                    return;
                 }
-                temp[(y * width + x) * channels + c] = accum;
+                body = body_;
+                begin = rangeBegin_;
+                end = rangeEnd_;
             }
-        }
-    }
-
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            for (int c = 0; c < channels; ++c) {
-                float accum = 0.0f;
-                for (int k = -radius; k <= radius; ++k) {
-                    const int yi = std::clamp(y + k, 0, height - 1);
-                    accum += temp[(yi * width + x) * channels + c] * kernel[k + radius];
+            runBand(band, begin, end, *body);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (--pending_ == 0) {
+                    done_.notify_one();
                 }
-                data[(y * width + x) * channels + c] = accum;
             }
         }
     }
-}
 
-static std::vector<float> createInitialDye(const Config& cfg) {
-    const int n = cfg.resolution;
-    std::vector<float> dye(n * n * 3);
-    std::mt19937 rng(42);
-    std::normal_distribution<float> noise(0.0f, 20.0f);
+    std::vector<std::thread> workers_;
+    int bandCount_ = 1;
+    bool pin_ = false;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const std::function<void(int, int)>* body_ = nullptr;
+    int rangeBegin_ = 0;
+    int rangeEnd_ = 0;
+    int pending_ = 0;
+    uint64_t generation_ = 0;
+    bool stopping_ = false;
+};
 
-    for (int y = 0; y < n; ++y) {
-        for (int x = 0; x < n; ++x) {
-            const int idx = (y * n + x) * 3;
-            dye[idx + 0] = 30.0f + noise(rng);
-            dye[idx + 1] = 90.0f + noise(rng);
-            dye[idx + 2] = 180.0f + noise(rng);
+// Runs two dependent row-banded stages without a barrier between them. Each
+// stage-2 band only waits for the stage-1 bands within `overlap` rows of it,
+// so workers flow into stage 2 as soon as their neighbourhood is ready
+// instead of idling at a pool-wide join. With `wrap`, bands whose cone spills
+// past an edge wait for all of stage 1 (their taps come from the far side of
+// the plane). Band boundaries depend only on the height and pool width, and
+// both stages compute each row from inputs alone, so results are identical
+// to running the stages back to back.
+template <typename Stage1, typename Stage2>
+static void runDependentStages(int height, int overlap, bool wrap, ThreadPool& pool,
+                               const Stage1& stage1, const Stage2& stage2) {
+    const int workers = pool.threadCount();
+    if (workers == 1 || height < workers * 2) {
+        stage1(0, height);
+        stage2(0, height);
+        return;
+    }
+    // A few bands per worker keeps the dependency cones narrow without
+    // shrinking bands below a useful grain.
+    const int bands = std::min(height, workers * 4);
+    const auto bandBegin = [&](int b) {
+        return static_cast<int>(static_cast<int64_t>(height) * b / bands);
+    };
+    const auto bandOfRow = [&](int row) {
+        int b = static_cast<int>(static_cast<int64_t>(row) * bands / height);
+        while (bandBegin(b + 1) <= row) {
+            ++b;
         }
+        while (bandBegin(b) > row) {
+            --b;
+        }
+        return b;
+    };
+
+    std::atomic<int> s1Next{0};
+    std::atomic<int> s2Remaining{bands};
+    std::vector<std::atomic<int>> s1Done(bands);
+    std::vector<std::atomic<int>> s2Claimed(bands);
+    for (int b = 0; b < bands; ++b) {
+        s1Done[b].store(0, std::memory_order_relaxed);
+        s2Claimed[b].store(0, std::memory_order_relaxed);
     }
 
-    for (int y = 0; y < n; ++y) {
-        for (int x = 0; x < n; ++x) {
-            const int idx = (y * n + x) * 3;
-            const float nx = (static_cast<float>(x) / (n - 1)) * 2.0f - 1.0f;
-            const float ny = (static_cast<float>(y) / (n - 1)) * 2.0f - 1.0f;
-            const float vignette = std::clamp(1.0f - 0.8f * std::hypot(nx, ny), 0.2f, 1.0f);
-            dye[idx + 0] = std::clamp(dye[idx + 0] * vignette, 0.0f, 255.0f);
-            dye[idx + 1] = std::clamp(dye[idx + 1] * vignette, 0.0f, 255.0f);
-            dye[idx + 2] = std::clamp(dye[idx + 2] * vignette, 0.0f, 255.0f);
+    pool.parallelFor(0, workers, [&](int workerBegin, int) {
+        int scan = workerBegin;  // stagger where each worker looks for stage-2 work
+        for (;;) {
+            // Stage-1 bands first: each one finished unlocks downstream work.
+            if (s1Next.load(std::memory_order_relaxed) < bands) {
+                const int b = s1Next.fetch_add(1, std::memory_order_relaxed);
+                if (b < bands) {
+                    stage1(bandBegin(b), bandBegin(b + 1));
+                    s1Done[b].store(1, std::memory_order_release);
+                    continue;
+                }
+            }
+            if (s2Remaining.load(std::memory_order_acquire) == 0) {
+                return;
+            }
+            bool ranOne = false;
+            for (int i = 0; i < bands; ++i) {
+                const int b = (scan + i) % bands;
+                if (s2Claimed[b].load(std::memory_order_relaxed) != 0) {
+                    continue;
+                }
+                const int rowBegin = bandBegin(b);
+                const int rowEnd = bandBegin(b + 1);
+                int depBegin = 0;
+                int depEnd = bands - 1;
+                if (!wrap || (rowBegin - overlap >= 0 && rowEnd - 1 + overlap < height)) {
+                    depBegin = bandOfRow(std::max(0, rowBegin - overlap));
+                    depEnd = bandOfRow(std::min(height - 1, rowEnd - 1 + overlap));
+                }
+                bool ready = true;
+                for (int d = depBegin; d <= depEnd; ++d) {
+                    if (s1Done[d].load(std::memory_order_acquire) == 0) {
+                        ready = false;
+                        break;
+                    }
+                }
+                if (!ready || s2Claimed[b].exchange(1, std::memory_order_relaxed) != 0) {
+                    continue;
+                }
+                stage2(rowBegin, rowEnd);
+                s2Remaining.fetch_sub(1, std::memory_order_acq_rel);
+                scan = b + 1;
+                ranOne = true;
+                break;
+            }
+            if (!ranOne) {
+                std::this_thread::yield();
+            }
         }
-    }
+    });
+}
+
+static float streamFunction(float x, float y, float t) {
+    constexpr float pi = 3.14159265358979323846f;
+    const float base = std::sin(2.0f * pi * (3.0f * x + 0.7f * t)) * std::sin(2.0f * pi * (3.0f * y - 0.5f * t));
+    const float swirl = std::cos(2.0f * pi * (2.0f * x - 0.3f * t)) * std::cos(2.0f * pi * (2.0f * y + 0.4f * t));
+    const float ripple = std::sin(2.0f * pi * (4.0f * x + y + 0.2f * t));
+    return base + 0.6f * swirl + 0.25f * ripple;
+}
 
-    return dye;
+// Polynomial sin approximation: range-reduce to [-pi, pi], then an odd
+// minimax polynomial. Max error is ~1e-4, far below what an 8-bit dye
+// image can resolve.
+static inline float fastSin(float x) {
+    constexpr float twoPi = 6.28318530717958647692f;
+    constexpr float invTwoPi = 0.15915494309189533577f;
+    x -= twoPi * std::floor(x * invTwoPi + 0.5f);
+    const float x2 = x * x;
+    return x * (0.99999660f + x2 * (-0.16664824f + x2 * (0.00830629f - x2 * 0.00018363f)));
 }
 
-static void advect(const std::vector<float>& field, const std::vector<float>& velocity, int width, int height, float dt, std::vector<float>& out) {
-    out.resize(field.size());
-    for (int y = 0; y < height; ++y) {
-        for (int x = 0; x < width; ++x) {
-            const int idx = y * width + x;
-            float xBack = static_cast<float>(x) - dt * velocity[2 * idx + 0];
-            float yBack = static_cast<float>(y) - dt * velocity[2 * idx + 1];
+static inline float fastCos(float x) {
+    constexpr float halfPi = 1.57079632679489661923f;
+    return fastSin(x + halfPi);
+}
 
-            xBack = std::clamp(xBack, 0.0f, static_cast<float>(width - 1));
-            yBack = std::clamp(yBack, 0.0f, static_cast<float>(height - 1));
+static float streamFunctionFast(float x, float y, float t) {
+    constexpr float pi = 3.14159265358979323846f;
+    const float base = fastSin(2.0f * pi * (3.0f * x + 0.7f * t)) * fastSin(2.0f * pi * (3.0f * y - 0.5f * t));
+    const float swirl = fastCos(2.0f * pi * (2.0f * x - 0.3f * t)) * fastCos(2.0f * pi * (2.0f * y + 0.4f * t));
+    const float ripple = fastSin(2.0f * pi * (4.0f * x + y + 0.2f * t));
+    return base + 0.6f * swirl + 0.25f * ripple;
+}
+
+#ifdef WATER_FLOW_X86_SIMD
+__attribute__((target("avx2,fma"))) static inline __m256 fastSinAvx2(__m256 x) {
+    const __m256 twoPi = _mm256_set1_ps(6.28318530717958647692f);
+    const __m256 invTwoPi = _mm256_set1_ps(0.15915494309189533577f);
+    const __m256 half = _mm256_set1_ps(0.5f);
+    const __m256 turns = _mm256_floor_ps(_mm256_fmadd_ps(x, invTwoPi, half));
+    x = _mm256_fnmadd_ps(twoPi, turns, x);
+    const __m256 x2 = _mm256_mul_ps(x, x);
+    __m256 p = _mm256_set1_ps(-0.00018363f);
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(0.00830629f));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(-0.16664824f));
+    p = _mm256_fmadd_ps(p, x2, _mm256_set1_ps(0.99999660f));
+    return _mm256_mul_ps(x, p);
+}
+
+// Evaluates one psi row for x in [0, n): every sin/cos argument is linear
+// in x, so each lane just offsets the row-constant phase by its own x term.
+__attribute__((target("avx2,fma"))) static void streamFunctionRowAvx2(int n, float fy, float t, float* psiRow) {
+    constexpr float pi = 3.14159265358979323846f;
+    constexpr float halfPi = 1.57079632679489661923f;
+    const float invN = 1.0f / static_cast<float>(n);
+    const float sinBaseY = fastSin(2.0f * pi * (3.0f * fy - 0.5f * t));
+    const float cosSwirlY = fastCos(2.0f * pi * (2.0f * fy + 0.4f * t));
 
-            const int x0 = static_cast<int>(std::floor(xBack));
-            const int y0 = static_cast<int>(std::floor(yBack));
-            const int x1 = std::min(x0 + 1, width - 1);
-            const int y1 = std::min(y0 + 1, height - 1);
+    const __m256 lane = _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    const __m256 vSinBaseY = _mm256_set1_ps(sinBaseY);
+    const __m256 vCosSwirlY = _mm256_set1_ps(cosSwirlY);
+    const __m256 swirlWeight = _mm256_set1_ps(0.6f);
+    const __m256 rippleWeight = _mm256_set1_ps(0.25f);
 
-            const float fx = xBack - static_cast<float>(x0);
-            const float fy = yBack - static_cast<float>(y0);
+    const float baseSlope = 2.0f * pi * 3.0f * invN;
+    const float swirlSlope = 2.0f * pi * 2.0f * invN;
+    const float rippleSlope = 2.0f * pi * 4.0f * invN;
+    const float basePhase = 2.0f * pi * 0.7f * t;
+    const float swirlPhase = 2.0f * pi * -0.3f * t + halfPi;  // cos via shifted sin
+    const float ripplePhase = 2.0f * pi * (fy + 0.2f * t);
 
-            for (int c = 0; c < 3; ++c) {
-                const float top = field[(y0 * width + x0) * 3 + c] * (1.0f - fx) + field[(y0 * width + x1) * 3 + c] * fx;
-                const float bottom = field[(y1 * width + x0) * 3 + c] * (1.0f - fx) + field[(y1 * width + x1) * 3 + c] * fx;
-                out[idx * 3 + c] = top * (1.0f - fy) + bottom * fy;
+    int x = 0;
+    for (; x + 8 <= n; x += 8) {
+        const __m256 fx = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), lane);
+        const __m256 base = fastSinAvx2(_mm256_fmadd_ps(fx, _mm256_set1_ps(baseSlope), _mm256_set1_ps(basePhase)));
+        const __m256 swirl = fastSinAvx2(_mm256_fmadd_ps(fx, _mm256_set1_ps(swirlSlope), _mm256_set1_ps(swirlPhase)));
+        const __m256 ripple = fastSinAvx2(_mm256_fmadd_ps(fx, _mm256_set1_ps(rippleSlope), _mm256_set1_ps(ripplePhase)));
+        __m256 psi = _mm256_mul_ps(base, vSinBaseY);
+        psi = _mm256_fmadd_ps(swirl, _mm256_mul_ps(swirlWeight, vCosSwirlY), psi);
+        psi = _mm256_fmadd_ps(ripple, rippleWeight, psi);
+        _mm256_storeu_ps(psiRow + x, psi);
+    }
+    for (; x < n; ++x) {
+        psiRow[x] = streamFunctionFast(static_cast<float>(x) * invN, fy, t);
+    }
+}
+
+static bool cpuSupportsAvx2() {
+    static const bool supported = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    return supported;
+}
+#endif
+
+// IEEE 754 binary16 conversions for --storage=fp16. The field kernels keep
+// all arithmetic in fp32 registers and only store halves, so these run once
+// per element load/store; floatToHalf rounds to nearest even.
+static inline float halfToFloat(uint16_t h) {
+    const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1F;
+    uint32_t mant = h & 0x3FF;
+    uint32_t bits;
+    if (exp == 0) {
+        if (mant == 0) {
+            bits = sign;
+        } else {
+            exp = 113;  // renormalize a subnormal half
+            while ((mant & 0x400) == 0) {
+                mant <<= 1;
+                --exp;
             }
+            bits = sign | (exp << 23) | ((mant & 0x3FF) << 13);
         }
+    } else if (exp == 31) {
+        bits = sign | 0x7F800000 | (mant << 13);
+    } else {
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
     }
+    float out;
+    std::memcpy(&out, &bits, sizeof(out));
+    return out;
 }
 
-static Config applyOverrides(Config cfg, const std::vector<std::string>& args) {
-    for (const auto& raw : args) {
-        if (raw.rfind("--", 0) != 0) {
-            std::cerr << "Ignoring argument '" << raw << "'. Use --key=value format or --no-live-view.\n";
-            continue;
-        }
-        const std::string keyValue = raw.substr(2);
-        if (keyValue == "no-live-view") {
-            cfg.liveView = false;
-            continue;
+static inline uint16_t floatToHalf(float f) {
+    uint32_t bits;
+    std::memcpy(&bits, &f, sizeof(bits));
+    const uint16_t sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+    const int32_t exp = static_cast<int32_t>((bits >> 23) & 0xFF) - 112;
+    uint32_t mant = bits & 0x7FFFFF;
+    if (exp >= 31) {
+        if (((bits >> 23) & 0xFF) == 255 && mant != 0) {
+            return static_cast<uint16_t>(sign | 0x7E00);  // NaN
         }
-        const auto pos = keyValue.find('=');
-        if (pos == std::string::npos) {
-            std::cerr << "Ignoring argument '--" << keyValue << "'. Expected --key=value format or --no-live-view.\n";
-            continue;
+        return static_cast<uint16_t>(sign | 0x7C00);  // infinity / overflow
+    }
+    if (exp <= 0) {
+        if (exp < -10) {
+            return sign;  // underflows to zero
         }
-        const std::string key = keyValue.substr(0, pos);
-        const std::string value = keyValue.substr(pos + 1);
-        try {
-            if (key == "steps") {
-                cfg.steps = std::stoi(value);
-            } else if (key == "resolution") {
-                cfg.resolution = std::stoi(value);
-            } else if (key == "dt") {
-                cfg.dt = std::stof(value);
-            } else if (key == "strength") {
-                cfg.strength = std::stof(value);
-            } else if (key == "gif-name") {
-                cfg.gifName = value;
-            } else if (key == "output-dir") {
-                cfg.outputDir = value;
-            } else if (key == "fps") {
-                cfg.fps = std::stoi(value);
-            } else {
-                std::cerr << "Unknown option '--" << key << "'.\n";
-            }
-        } catch (const std::exception& ex) {
-            std::cerr << "Failed to parse value for '--" << key << "': " << ex.what() << "\n";
+        mant |= 0x800000;
+        const int shift = 14 - exp;
+        uint32_t half = mant >> shift;
+        const uint32_t halfway = 1u << (shift - 1);
+        const uint32_t rem = mant & ((1u << shift) - 1);
+        if (rem > halfway || (rem == halfway && (half & 1))) {
+            ++half;
         }
+        return static_cast<uint16_t>(sign | half);
     }
-    return cfg;
+    uint16_t half = static_cast<uint16_t>(sign | (exp << 10) | (mant >> 13));
+    const uint32_t rem = mant & 0x1FFF;
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) {
+        ++half;  // the carry may bump the exponent, which is the correct rounding
+    }
+    return half;
 }
 
-static void ensureOutputDir(const std::filesystem::path& dir) {
-    if (!dir.empty()) {
-        std::filesystem::create_directories(dir);
+// Element accessors the field kernels go through; for float storage they
+// compile away entirely.
+static inline float storageToFloat(float v) { return v; }
+static inline float storageToFloat(uint16_t v) { return halfToFloat(v); }
+
+template <typename S>
+static inline S floatToStorage(float v) {
+    if constexpr (std::is_same_v<S, float>) {
+        return v;
+    } else {
+        return floatToHalf(v);
     }
 }
 
-int main(int argc, char** argv) {
-    Magick::InitializeMagick(nullptr);
+// Allocator whose default construct is a no-op, so sizing a field buffer
+// commits no pages: the first write wins instead, and with --pin-threads
+// that write happens on the worker that owns the band, placing each band's
+// pages on that worker's NUMA node (first-touch). Every field buffer is
+// fully written by a banded pass before it is read, so skipping the zero
+// fill does not change any result.
+template <typename T>
+struct UninitializedAllocator : std::allocator<T> {
+    template <typename U>
+    struct rebind {
+        using other = UninitializedAllocator<U>;
+    };
+    template <typename U>
+    void construct(U* p) noexcept {
+        ::new (static_cast<void*>(p)) U;  // default-init: no store for scalars
+    }
+    template <typename U, typename... Args>
+    void construct(U* p, Args&&... args) {
+        ::new (static_cast<void*>(p)) U(std::forward<Args>(args)...);
+    }
+};
 
-    Config cfg;
-    std::vector<std::string> args;
-    for (int i = 1; i < argc; ++i) {
-        args.emplace_back(argv[i]);
+// Row-banded simulation fields (dye, velocity, psi, blur planes).
+template <typename T>
+using FieldVector = std::vector<T, UninitializedAllocator<T>>;
+
+// Bulk conversions at the fp32 interop boundaries (checkpoints, CUDA).
+static std::vector<float> fieldToFloat(const FieldVector<uint16_t>& src) {
+    std::vector<float> out(src.size());
+    for (size_t i = 0; i < src.size(); ++i) {
+        out[i] = halfToFloat(src[i]);
     }
-    cfg = applyOverrides(cfg, args);
+    return out;
+}
 
-    const int n = cfg.resolution;
-    std::vector<float> baseDye = createInitialDye(cfg);
-    std::vector<float> dye = baseDye;
-    std::vector<float> tempDye(dye.size());
-    std::vector<float> velocity;
+static void fieldFromFloat(const std::vector<float>& src, FieldVector<uint16_t>& dst) {
+    dst.resize(src.size());
+    for (size_t i = 0; i < src.size(); ++i) {
+        dst[i] = floatToHalf(src[i]);
+    }
+}
 
-    ensureOutputDir(cfg.outputDir);
-    const std::string gifPath = (cfg.outputDir / cfg.gifName).string();
+// All per-step scratch memory, allocated once in main and reused by the
+// kernels so the steady-state loop performs zero heap allocations.
+struct SimBuffers {
+    FieldVector<float> psi;
+    FieldVector<float> blurPlane;
+    FieldVector<float> blurTemp;
+    std::vector<float> blurKernel;
+    std::vector<float> boxSums;
+    float blurKernelSigma = -1.0f;
+
+    explicit SimBuffers(int n)
+        : psi(static_cast<size_t>(n) * n),
+          blurPlane(static_cast<size_t>(n) * n),
+          blurTemp(static_cast<size_t>(n) * n),
+          boxSums(static_cast<size_t>(n)) {}
+};
 
-    std::vector<unsigned char> rgbBuffer(n * n * 3);
+// Boundary policies for the stencil kernels. The blur and advection kernels
+// are templated on one of these so the interior runs through the check-free
+// Interior instantiation, and --boundary=wrap turns the borders periodic:
+// the stream function only has integer wave numbers, so a wrapped render
+// tiles seamlessly instead of faking it in post.
+struct ClampBoundary {
+    static int index(int i, int extent) { return std::clamp(i, 0, extent - 1); }
+    static float coord(float v, int extent) { return std::clamp(v, 0.0f, static_cast<float>(extent - 1)); }
+    static int next(int i, int extent) { return std::min(i + 1, extent - 1); }
+};
 
-#ifdef USE_OPENCV
-    cv::Mat display;
-    std::vector<unsigned char> displayBuffer(n * n * 3);
-    const double pauseSeconds = 1.0 / static_cast<double>(std::max(1, cfg.fps));
-    const int pauseMs = std::max(1, static_cast<int>(pauseSeconds * 1000.0));
-    if (cfg.liveView) {
-        cv::namedWindow("Procedural Water Flow", cv::WINDOW_AUTOSIZE);
+struct WrapBoundary {
+    static int index(int i, int extent) {
+        const int m = i % extent;
+        return m < 0 ? m + extent : m;
     }
+    static float coord(float v, int extent) {
+        const float e = static_cast<float>(extent);
+        v -= e * std::floor(v / e);
+        return v < e ? v : 0.0f;  // rounding guard: floor can land exactly on e
+    }
+    static int next(int i, int extent) { return i + 1 == extent ? 0 : i + 1; }
+};
+
+struct InteriorBoundary {
+    static int index(int i, int) { return i; }
+};
+
+// Production renders only use a handful of power-of-two sizes. Dispatching
+// the hot kernels on a compile-time extent lets the compiler strength-reduce
+// y * width + x into shifts and unroll loops with known trip counts; every
+// other size runs the kDynamicExtent instantiation with runtime width.
+constexpr int kDynamicExtent = 0;
+
+template <typename Fn>
+static void withExtent(int extent, Fn&& fn) {
+    switch (extent) {
+        case 512: fn(std::integral_constant<int, 512>{}); break;
+        case 1024: fn(std::integral_constant<int, 1024>{}); break;
+        case 2048: fn(std::integral_constant<int, 2048>{}); break;
+        case 4096: fn(std::integral_constant<int, 4096>{}); break;
+        default: fn(std::integral_constant<int, kDynamicExtent>{}); break;
+    }
+}
+
+template <typename S>
+static void buildVelocityField(const Config& cfg, float t, FieldVector<S>& velocity, SimBuffers& buffers, ThreadPool& pool) {
+    const int n = cfg.resolution;
+    FieldVector<float>& psi = buffers.psi;
+#ifdef WATER_FLOW_X86_SIMD
+    const bool useAvx2 = cfg.fastMath && cpuSupportsAvx2();
+#endif
+    const auto psiRows = [&](int rowBegin, int rowEnd) {
+        for (int y = rowBegin; y < rowEnd; ++y) {
+            const float fy = static_cast<float>(y) / static_cast<float>(n);
+#ifdef WATER_FLOW_X86_SIMD
+            if (useAvx2) {
+                streamFunctionRowAvx2(n, fy, t, psi.data() + y * n);
+                continue;
+            }
 #endif
+            for (int x = 0; x < n; ++x) {
+                const float fx = static_cast<float>(x) / static_cast<float>(n);
+                psi[y * n + x] = cfg.fastMath ? streamFunctionFast(fx, fy, t) : streamFunction(fx, fy, t);
+            }
+        }
+    };
 
-    std::vector<Magick::Image> frames;
-    frames.reserve(cfg.steps);
-    const size_t delayCs = std::max<size_t>(1, static_cast<size_t>(std::round(100.0 / std::max(1, cfg.fps))));
+    velocity.resize(n * n * 2);
+    const float scale = cfg.strength * static_cast<float>(n) * 0.5f;
 
-    for (int step = 0; step < cfg.steps; ++step) {
-        const float t = static_cast<float>(step) / static_cast<float>(cfg.steps) * 6.0f;
-        buildVelocityField(cfg, t, velocity);
-        gaussianBlur(velocity, n, n, 2, 1.0f);
-        advect(dye, velocity, n, n, cfg.dt, tempDye);
+    const auto curl = [&](auto boundary, int rowBegin, int rowEnd) {
+        using Boundary = decltype(boundary);
+        for (int y = rowBegin; y < rowEnd; ++y) {
+            const int yp = Boundary::index(y + 1, n);
+            const int ym = Boundary::index(y - 1, n);
+            for (int x = 0; x < n; ++x) {
+                const int idx = y * n + x;
+                const int xp = Boundary::index(x + 1, n);
+                const int xm = Boundary::index(x - 1, n);
 
-        for (size_t i = 0; i < dye.size(); ++i) {
-            dye[i] = 0.995f * tempDye[i] + 0.005f * baseDye[i];
+                const float dpsi_dx = (psi[y * n + xp] - psi[y * n + xm]);
+                const float dpsi_dy = (psi[yp * n + x] - psi[ym * n + x]);
+
+                velocity[2 * idx + 0] = floatToStorage<S>(dpsi_dy * scale);
+                velocity[2 * idx + 1] = floatToStorage<S>(-dpsi_dx * scale);
+            }
+        }
+    };
+    // The curl stencil only reaches one row up and down, so a curl band can
+    // start as soon as its neighbouring psi bands exist.
+    runDependentStages(n, 1, cfg.wrapBoundary, pool, psiRows, [&](int rowBegin, int rowEnd) {
+        if (cfg.wrapBoundary) {
+            curl(WrapBoundary{}, rowBegin, rowEnd);
+        } else {
+            curl(ClampBoundary{}, rowBegin, rowEnd);
         }
+    });
+}
 
-        for (int i = 0; i < n * n; ++i) {
-            const float r = std::clamp(dye[3 * i + 0], 0.0f, 255.0f);
-            const float g = std::clamp(dye[3 * i + 1], 0.0f, 255.0f);
-            const float b = std::clamp(dye[3 * i + 2], 0.0f, 255.0f);
-            rgbBuffer[3 * i + 0] = static_cast<unsigned char>(r);
-            rgbBuffer[3 * i + 1] = static_cast<unsigned char>(g);
-            rgbBuffer[3 * i + 2] = static_cast<unsigned char>(b);
-#ifdef USE_OPENCV
-            if (cfg.liveView) {
-                displayBuffer[3 * i + 0] = static_cast<unsigned char>(b);
-                displayBuffer[3 * i + 1] = static_cast<unsigned char>(g);
-                displayBuffer[3 * i + 2] = static_cast<unsigned char>(r);
+// One horizontal convolution segment under a boundary policy. The Interior
+// instantiation compiles down to contiguous unit-stride loads with no index
+// arithmetic, which is what the bulk of every row runs through.
+template <int kExtent, typename Boundary>
+static void blurRowSegment(const float* srcRow, float* dstRow, int xBegin, int xEnd,
+                           int width, const float* kernel, int radius) {
+    const int w = kExtent == kDynamicExtent ? width : kExtent;
+    for (int x = xBegin; x < xEnd; ++x) {
+        float accum = 0.0f;
+        for (int k = -radius; k <= radius; ++k) {
+            accum += srcRow[Boundary::index(x + k, w)] * kernel[k + radius];
+        }
+        dstRow[x] = accum;
+    }
+}
+
+// Horizontal separable pass over a single plane. Only the first and last
+// `radius` columns pay the boundary policy; the interior dispatches through
+// the check-free instantiation, so the compiler vectorizes it.
+template <int kExtent, typename Boundary>
+static void blurPlaneHorizontalRows(const float* src, float* dst, int width,
+                                    const float* kernel, int radius, int rowBegin, int rowEnd) {
+    const int w = kExtent == kDynamicExtent ? width : kExtent;
+    const int interiorBegin = std::min(radius, w);
+    const int interiorEnd = std::max(interiorBegin, w - radius);
+    for (int y = rowBegin; y < rowEnd; ++y) {
+        const float* srcRow = src + static_cast<size_t>(y) * w;
+        float* dstRow = dst + static_cast<size_t>(y) * w;
+        blurRowSegment<kExtent, Boundary>(srcRow, dstRow, 0, interiorBegin, w, kernel, radius);
+        blurRowSegment<kExtent, InteriorBoundary>(srcRow, dstRow, interiorBegin, interiorEnd, w, kernel, radius);
+        blurRowSegment<kExtent, Boundary>(srcRow, dstRow, interiorEnd, w, w, kernel, radius);
+    }
+}
+
+// Vertical pass: interior rows read whole rows through the check-free policy,
+// so the inner x loop is again branch-free and unit-stride across the plane.
+template <int kExtent, typename Boundary>
+static void blurPlaneVerticalRows(const float* src, float* dst, int width, int height,
+                                  const float* kernel, int radius, int rowBegin, int rowEnd) {
+    const int w = kExtent == kDynamicExtent ? width : kExtent;
+    const int h = kExtent == kDynamicExtent ? height : kExtent;
+    for (int y = rowBegin; y < rowEnd; ++y) {
+        float* dstRow = dst + static_cast<size_t>(y) * w;
+        const bool interior = y >= radius && y < h - radius;
+        for (int x = 0; x < w; ++x) {
+            dstRow[x] = 0.0f;
+        }
+        for (int k = -radius; k <= radius; ++k) {
+            const int yi = interior ? y + k : Boundary::index(y + k, h);
+            const float* srcRow = src + static_cast<size_t>(yi) * w;
+            const float weight = kernel[k + radius];
+            for (int x = 0; x < w; ++x) {
+                dstRow[x] += srcRow[x] * weight;
             }
-#endif
         }
+    }
+}
 
-        Magick::Image frame;
-        frame.size(Magick::Geometry(n, n));
-        frame.depth(8);
-        frame.magick("RGB");
-        frame.read(n, n, "RGB", Magick::CharPixel, rgbBuffer.data());
-        frame.animationDelay(static_cast<size_t>(delayCs));
-        frames.emplace_back(std::move(frame));
+// Running-sum box pass: O(1) per pixel independent of radius. The boundary
+// policy only shows up in the prologue sum and the edge taps of the running
+// update.
+template <int kExtent, typename Boundary>
+static void boxBlurPlaneHorizontal(const float* src, float* dst, int width, int height,
+                                   int radius, ThreadPool& pool) {
+    const int w = kExtent == kDynamicExtent ? width : kExtent;
+    const float inv = 1.0f / static_cast<float>(2 * radius + 1);
+    pool.parallelFor(0, height, [&](int rowBegin, int rowEnd) {
+        for (int y = rowBegin; y < rowEnd; ++y) {
+            const float* srcRow = src + static_cast<size_t>(y) * w;
+            float* dstRow = dst + static_cast<size_t>(y) * w;
+            float sum = srcRow[0];
+            for (int k = 1; k <= radius; ++k) {
+                sum += srcRow[Boundary::index(-k, w)] + srcRow[Boundary::index(k, w)];
+            }
+            for (int x = 0; x < w; ++x) {
+                dstRow[x] = sum * inv;
+                sum += srcRow[Boundary::index(x + radius + 1, w)] - srcRow[Boundary::index(x - radius, w)];
+            }
+        }
+    });
+}
 
-#ifdef USE_OPENCV
-        if (cfg.liveView) {
-            display = cv::Mat(n, n, CV_8UC3, displayBuffer.data()).clone();
-            cv::imshow("Procedural Water Flow", display);
-            const int key = cv::waitKey(pauseMs);
-            if (key == 27) {
-                std::cout << "Stopping simulation (ESC pressed).\n";
-                break;
+// `sums` is a caller-provided width-sized scratch array; the column bands
+// handed out by the pool are disjoint, so workers share it without overlap.
+template <int kExtent, typename Boundary>
+static void boxBlurPlaneVertical(const float* src, float* dst, int width, int height,
+                                 int radius, float* sums, ThreadPool& pool) {
+    const int w = kExtent == kDynamicExtent ? width : kExtent;
+    const int h = kExtent == kDynamicExtent ? height : kExtent;
+    const float inv = 1.0f / static_cast<float>(2 * radius + 1);
+    pool.parallelFor(0, w, [&](int colBegin, int colEnd) {
+        for (int x = colBegin; x < colEnd; ++x) {
+            float sum = src[x];
+            for (int k = 1; k <= radius; ++k) {
+                sum += src[static_cast<size_t>(Boundary::index(-k, h)) * w + x] +
+                       src[static_cast<size_t>(Boundary::index(k, h)) * w + x];
             }
+            sums[x] = sum;
         }
-#endif
+        for (int y = 0; y < h; ++y) {
+            const float* addRow = src + static_cast<size_t>(Boundary::index(y + radius + 1, h)) * w;
+            const float* subRow = src + static_cast<size_t>(Boundary::index(y - radius, h)) * w;
+            float* dstRow = dst + static_cast<size_t>(y) * w;
+            for (int x = colBegin; x < colEnd; ++x) {
+                dstRow[x] = sums[x] * inv;
+                sums[x] += addRow[x] - subRow[x];
+            }
+        }
+    });
+}
+
+// Three box radii whose chain approximates a Gaussian of the given sigma.
+static void boxRadiiForSigma(float sigma, int radii[3]) {
+    const float wIdeal = std::sqrt(12.0f * sigma * sigma / 3.0f + 1.0f);
+    int wl = static_cast<int>(std::floor(wIdeal));
+    if (wl % 2 == 0) {
+        --wl;
     }
+    wl = std::max(1, wl);
+    const int wu = wl + 2;
+    const float mIdeal = (12.0f * sigma * sigma - 3.0f * wl * wl - 12.0f * wl - 9.0f) / (-4.0f * wl - 4.0f);
+    const int m = std::clamp(static_cast<int>(std::round(mIdeal)), 0, 3);
+    for (int i = 0; i < 3; ++i) {
+        radii[i] = ((i < m ? wl : wu) - 1) / 2;
+    }
+}
 
-    try {
-        Magick::writeImages(frames.begin(), frames.end(), gifPath);
-        std::cout << "Saved animation to " << gifPath << "\n";
-    } catch (const Magick::Exception& err) {
-        std::cerr << "Failed to write GIF: " << err.what() << "\n";
-        return 1;
+// Deinterleaves each channel into its own plane so both separable passes run
+// over contiguous memory, then writes the result back. --blur-mode=box swaps
+// the exact kernel for a three-pass running-sum chain whose cost does not
+// grow with sigma.
+template <typename S>
+static void gaussianBlur(FieldVector<S>& data, int width, int height, int channels,
+                         float sigma, bool boxApprox, bool wrap, SimBuffers& buffers, ThreadPool& pool) {
+    if (sigma <= 0.0f) {
+        return;
+    }
+    const int radius = std::max(1, static_cast<int>(sigma * 3.0f));
+    int boxRadii[3] = {0, 0, 0};
+    if (boxApprox) {
+        boxRadiiForSigma(sigma, boxRadii);
+    } else if (buffers.blurKernelSigma != sigma) {
+        buffers.blurKernel.resize(2 * radius + 1);
+        float sum = 0.0f;
+        for (int i = -radius; i <= radius; ++i) {
+            const float value = std::exp(-(i * i) / (2.0f * sigma * sigma));
+            buffers.blurKernel[i + radius] = value;
+            sum += value;
+        }
+        for (float& v : buffers.blurKernel) {
+            v /= sum;
+        }
+        buffers.blurKernelSigma = sigma;
     }
+    const std::vector<float>& kernel = buffers.blurKernel;
 
-#ifdef USE_OPENCV
-    if (cfg.liveView) {
-        cv::destroyWindow("Procedural Water Flow");
+    FieldVector<float>& plane = buffers.blurPlane;
+    FieldVector<float>& temp = buffers.blurTemp;
+
+    for (int c = 0; c < channels; ++c) {
+        pool.parallelFor(0, height, [&](int rowBegin, int rowEnd) {
+            for (size_t i = static_cast<size_t>(rowBegin) * width; i < static_cast<size_t>(rowEnd) * width; ++i) {
+                plane[i] = storageToFloat(data[i * channels + c]);
+            }
+        });
+
+        const auto runPasses = [&](auto boundary, auto extent) {
+            using Boundary = decltype(boundary);
+            constexpr int kExtent = decltype(extent)::value;
+            if (boxApprox) {
+                for (int pass = 0; pass < 3; ++pass) {
+                    boxBlurPlaneHorizontal<kExtent, Boundary>(plane.data(), temp.data(), width, height,
+                                                              boxRadii[pass], pool);
+                    boxBlurPlaneVertical<kExtent, Boundary>(temp.data(), plane.data(), width, height, boxRadii[pass],
+                                                            buffers.boxSums.data(), pool);
+                }
+            } else {
+                // A vertical band only needs the horizontal rows within
+                // `radius` of it, so the passes run barrier-free. The box
+                // path keeps its joins: its vertical pass is column-banded
+                // and every column depends on the whole horizontal plane.
+                runDependentStages(
+                    height, radius, wrap, pool,
+                    [&](int rowBegin, int rowEnd) {
+                        blurPlaneHorizontalRows<kExtent, Boundary>(plane.data(), temp.data(), width,
+                                                                   kernel.data(), radius, rowBegin, rowEnd);
+                    },
+                    [&](int rowBegin, int rowEnd) {
+                        blurPlaneVerticalRows<kExtent, Boundary>(temp.data(), plane.data(), width, height,
+                                                                 kernel.data(), radius, rowBegin, rowEnd);
+                    });
+            }
+        };
+        withExtent(width == height ? width : kDynamicExtent, [&](auto extent) {
+            if (wrap) {
+                runPasses(WrapBoundary{}, extent);
+            } else {
+                runPasses(ClampBoundary{}, extent);
+            }
+        });
+
+        pool.parallelFor(0, height, [&](int rowBegin, int rowEnd) {
+            for (size_t i = static_cast<size_t>(rowBegin) * width; i < static_cast<size_t>(rowEnd) * width; ++i) {
+                data[i * channels + c] = floatToStorage<S>(plane[i]);
+            }
+        });
     }
-#endif
+}
 
-    return 0;
+// Per-tile convergence tracking for --tile-skip. advectBlendConvert records
+// the largest dye change inside each 32x32 tile; once a tile has stayed below
+// the 8-bit visibility threshold for a few consecutive steps it is skipped
+// (dye copied, pixels repacked) until the velocity over it moves materially
+// or the periodic full refresh comes around.
+struct TileActivity {
+    static constexpr int kTileSize = 32;
+    static constexpr float kDeltaThreshold = 0.5f;  // below one 8-bit level
+    static constexpr float kVelocityRelTol = 0.02f;  // fraction of the resting magnitude
+    static constexpr int kQuietSteps = 3;
+    static constexpr int kRefreshEvery = 32;
+
+    int tilesX;
+    int tilesY;
+    std::vector<int> quiet;          // consecutive below-threshold steps
+    std::vector<float> restingMag;   // per-tile max |velocity| when last computed
+    std::vector<float> currentMag;   // per-tile max |velocity| this step
+    std::vector<unsigned char> skip;
+    int step = 0;
+    size_t skippedTiles = 0;
+    size_t totalTiles = 0;
+
+    TileActivity(int width, int height)
+        : tilesX((width + kTileSize - 1) / kTileSize),
+          tilesY((height + kTileSize - 1) / kTileSize),
+          quiet(static_cast<size_t>(tilesX) * tilesY, 0),
+          restingMag(static_cast<size_t>(tilesX) * tilesY, 0.0f),
+          currentMag(static_cast<size_t>(tilesX) * tilesY, 0.0f),
+          skip(static_cast<size_t>(tilesX) * tilesY, 0) {}
+};
+
+constexpr int kAdvectSpanWidth = 128;
+
+// Kernel shared by both advectBlendConvert paths: backtrace one row span,
+// then replay the offsets per channel with the blend and 8-bit pack. Returns
+// the largest absolute dye change over the span when trackDelta is set. The
+// boundary policy folds the backtraced sample position back into the grid;
+// kExtent pins the grid size at compile time for the production resolutions.
+template <int kExtent, typename Boundary, typename S>
+static float advectSpan(const S* field, const S* baseField, const S* velocity,
+                        int width, int height, float dt, float keepWeight, float baseWeight,
+                        S* out, unsigned char* rgb, size_t planeSize,
+                        int y, int xBegin, int spanWidth, bool trackDelta) {
+    const int w = kExtent == kDynamicExtent ? width : kExtent;
+    const int h = kExtent == kDynamicExtent ? height : kExtent;
+    int offset00[kAdvectSpanWidth];
+    int offset01[kAdvectSpanWidth];
+    int offset10[kAdvectSpanWidth];
+    int offset11[kAdvectSpanWidth];
+    float weightX[kAdvectSpanWidth];
+    float weightY[kAdvectSpanWidth];
+
+    for (int i = 0; i < spanWidth; ++i) {
+        const int x = xBegin + i;
+        const int idx = y * w + x;
+        float xBack = static_cast<float>(x) - dt * storageToFloat(velocity[2 * idx + 0]);
+        float yBack = static_cast<float>(y) - dt * storageToFloat(velocity[2 * idx + 1]);
+
+        xBack = Boundary::coord(xBack, w);
+        yBack = Boundary::coord(yBack, h);
+
+        const int x0 = static_cast<int>(xBack);
+        const int y0 = static_cast<int>(yBack);
+        const int x1 = Boundary::next(x0, w);
+        const int y1 = Boundary::next(y0, h);
+
+        offset00[i] = y0 * w + x0;
+        offset01[i] = y0 * w + x1;
+        offset10[i] = y1 * w + x0;
+        offset11[i] = y1 * w + x1;
+        weightX[i] = xBack - static_cast<float>(x0);
+        weightY[i] = yBack - static_cast<float>(y0);
+    }
+
+    float delta = 0.0f;
+    for (int c = 0; c < 3; ++c) {
+        const S* src = field + c * planeSize;
+        const S* center = src + static_cast<size_t>(y) * w + xBegin;
+        const S* base = baseField + c * planeSize + static_cast<size_t>(y) * w + xBegin;
+        S* dst = out + c * planeSize + static_cast<size_t>(y) * w + xBegin;
+        unsigned char* rgbRow = rgb + 3 * (static_cast<size_t>(y) * w + xBegin);
+        for (int i = 0; i < spanWidth; ++i) {
+            const float fx = weightX[i];
+            const float fy = weightY[i];
+            const float top = storageToFloat(src[offset00[i]]) * (1.0f - fx) + storageToFloat(src[offset01[i]]) * fx;
+            const float bottom = storageToFloat(src[offset10[i]]) * (1.0f - fx) + storageToFloat(src[offset11[i]]) * fx;
+            const float blended = keepWeight * (top * (1.0f - fy) + bottom * fy) + baseWeight * storageToFloat(base[i]);
+            dst[i] = floatToStorage<S>(blended);
+            rgbRow[3 * i + c] = static_cast<unsigned char>(std::clamp(blended, 0.0f, 255.0f));
+            if (trackDelta) {
+                delta = std::max(delta, std::abs(blended - storageToFloat(center[i])));
+            }
+        }
+    }
+    return delta;
+}
+
+// Fused variant of advect for the render loop: the channel replay also blends
+// toward the base field and packs the clamped 8-bit pixel, so each dye
+// element is read and written exactly once per step instead of streaming the
+// full field through three separate passes. The blend weights are passed
+// individually to keep the arithmetic identical to the old two-pass form.
+// With a TileActivity tracker (--tile-skip) the work is partitioned into
+// 32x32 tiles and converged tiles are copied through instead of recomputed.
+template <int kExtent, typename Boundary, typename S>
+static void advectBlendConvertImpl(const FieldVector<S>& field, const FieldVector<S>& baseField,
+                                   const FieldVector<S>& velocity, int width, int height, float dt,
+                                   float keepWeight, float baseWeight, FieldVector<S>& out,
+                                   unsigned char* rgb, ThreadPool& pool, TileActivity* activity) {
+    const int w = kExtent == kDynamicExtent ? width : kExtent;
+    const int h = kExtent == kDynamicExtent ? height : kExtent;
+    out.resize(field.size());
+    const size_t planeSize = static_cast<size_t>(w) * h;
+
+    if (activity == nullptr) {
+        pool.parallelFor(0, h, [&](int rowBegin, int rowEnd) {
+            for (int y = rowBegin; y < rowEnd; ++y) {
+                for (int spanX = 0; spanX < w; spanX += kAdvectSpanWidth) {
+                    advectSpan<kExtent, Boundary>(field.data(), baseField.data(), velocity.data(), w, h, dt,
+                                                  keepWeight, baseWeight, out.data(), rgb, planeSize,
+                                                  y, spanX, std::min(kAdvectSpanWidth, w - spanX), false);
+                }
+            }
+        });
+        return;
+    }
+
+    const int tileSize = TileActivity::kTileSize;
+    const bool refresh = activity->step % TileActivity::kRefreshEvery == 0;
+
+    // Phase 1: current per-tile velocity extremes and the skip decision. A
+    // quiet tile stays skipped only while the velocity over it is close to
+    // what it was when the tile last converged.
+    pool.parallelFor(0, activity->tilesY, [&](int tyBegin, int tyEnd) {
+        for (int ty = tyBegin; ty < tyEnd; ++ty) {
+            for (int tx = 0; tx < activity->tilesX; ++tx) {
+                const int tile = ty * activity->tilesX + tx;
+                const int yEnd = std::min((ty + 1) * tileSize, h);
+                const int xEnd = std::min((tx + 1) * tileSize, w);
+                float mag = 0.0f;
+                for (int y = ty * tileSize; y < yEnd; ++y) {
+                    for (int x = tx * tileSize; x < xEnd; ++x) {
+                        const int idx = y * w + x;
+                        mag = std::max(mag, std::abs(storageToFloat(velocity[2 * idx + 0])));
+                        mag = std::max(mag, std::abs(storageToFloat(velocity[2 * idx + 1])));
+                    }
+                }
+                activity->currentMag[tile] = mag;
+                activity->skip[tile] = !refresh && activity->quiet[tile] >= TileActivity::kQuietSteps &&
+                                       std::abs(mag - activity->restingMag[tile]) <=
+                                           TileActivity::kVelocityRelTol * std::max(1.0f, activity->restingMag[tile]);
+            }
+        }
+    });
+
+    for (const unsigned char s : activity->skip) {
+        activity->skippedTiles += s;
+    }
+    activity->totalTiles += activity->skip.size();
+
+    // Phase 2: skipped tiles copy the dye through and repack their pixels;
+    // active tiles run the full kernel and update their convergence state.
+    pool.parallelFor(0, activity->tilesY, [&](int tyBegin, int tyEnd) {
+        for (int ty = tyBegin; ty < tyEnd; ++ty) {
+            for (int tx = 0; tx < activity->tilesX; ++tx) {
+                const int tile = ty * activity->tilesX + tx;
+                const int yEnd = std::min((ty + 1) * tileSize, h);
+                const int xBegin = tx * tileSize;
+                const int spanWidth = std::min(tileSize, w - xBegin);
+
+                if (activity->skip[tile]) {
+                    for (int y = ty * tileSize; y < yEnd; ++y) {
+                        unsigned char* rgbRow = rgb + 3 * (static_cast<size_t>(y) * w + xBegin);
+                        for (int c = 0; c < 3; ++c) {
+                            const S* src = field.data() + c * planeSize + static_cast<size_t>(y) * w + xBegin;
+                            S* dst = out.data() + c * planeSize + static_cast<size_t>(y) * w + xBegin;
+                            for (int i = 0; i < spanWidth; ++i) {
+                                dst[i] = src[i];
+                                rgbRow[3 * i + c] = static_cast<unsigned char>(std::clamp(storageToFloat(src[i]), 0.0f, 255.0f));
+                            }
+                        }
+                    }
+                    continue;
+                }
+
+                float delta = 0.0f;
+                for (int y = ty * tileSize; y < yEnd; ++y) {
+                    delta = std::max(delta, advectSpan<kExtent, Boundary>(field.data(), baseField.data(), velocity.data(),
+                                                                          w, h, dt, keepWeight, baseWeight,
+                                                                          out.data(), rgb, planeSize, y, xBegin, spanWidth, true));
+                }
+                activity->quiet[tile] = delta < TileActivity::kDeltaThreshold ? activity->quiet[tile] + 1 : 0;
+                activity->restingMag[tile] = activity->currentMag[tile];
+            }
+        }
+    });
+    ++activity->step;
+}
+
+template <typename S>
+static void advectBlendConvert(const FieldVector<S>& field, const FieldVector<S>& baseField,
+                               const FieldVector<S>& velocity, int width, int height, float dt,
+                               float keepWeight, float baseWeight, FieldVector<S>& out,
+                               unsigned char* rgb, ThreadPool& pool, bool wrap,
+                               TileActivity* activity = nullptr) {
+    withExtent(width == height ? width : kDynamicExtent, [&](auto extent) {
+        constexpr int kExtent = decltype(extent)::value;
+        if (wrap) {
+            advectBlendConvertImpl<kExtent, WrapBoundary>(field, baseField, velocity, width, height, dt,
+                                                          keepWeight, baseWeight, out, rgb, pool, activity);
+        } else {
+            advectBlendConvertImpl<kExtent, ClampBoundary>(field, baseField, velocity, width, height, dt,
+                                                           keepWeight, baseWeight, out, rgb, pool, activity);
+        }
+    });
+}
+
+// Plain semi-Lagrangian advection of the full 3-channel field: the same
+// backtrace and per-channel replay as advectSpan, without the blend/pack
+// epilogue. Used for the MacCormack forward and backward passes, where the
+// intermediate fields are inputs to the corrector rather than output frames.
+template <int kExtent, typename Boundary, typename S>
+static void advectFieldImpl(const FieldVector<S>& field, const FieldVector<S>& velocity,
+                            int widthIn, int heightIn, float dt, FieldVector<S>& out, ThreadPool& pool) {
+    const int w = kExtent == kDynamicExtent ? widthIn : kExtent;
+    const int h = kExtent == kDynamicExtent ? heightIn : kExtent;
+    out.resize(field.size());
+    const size_t planeSize = static_cast<size_t>(w) * h;
+
+    pool.parallelFor(0, h, [&](int rowBegin, int rowEnd) {
+        int offset00[kAdvectSpanWidth];
+        int offset01[kAdvectSpanWidth];
+        int offset10[kAdvectSpanWidth];
+        int offset11[kAdvectSpanWidth];
+        float weightX[kAdvectSpanWidth];
+        float weightY[kAdvectSpanWidth];
+
+        for (int y = rowBegin; y < rowEnd; ++y) {
+            for (int xBegin = 0; xBegin < w; xBegin += kAdvectSpanWidth) {
+                const int spanWidth = std::min(kAdvectSpanWidth, w - xBegin);
+                for (int i = 0; i < spanWidth; ++i) {
+                    const int x = xBegin + i;
+                    const int idx = y * w + x;
+                    float xBack = static_cast<float>(x) - dt * storageToFloat(velocity[2 * idx + 0]);
+                    float yBack = static_cast<float>(y) - dt * storageToFloat(velocity[2 * idx + 1]);
+
+                    xBack = Boundary::coord(xBack, w);
+                    yBack = Boundary::coord(yBack, h);
+
+                    const int x0 = static_cast<int>(xBack);
+                    const int y0 = static_cast<int>(yBack);
+                    const int x1 = Boundary::next(x0, w);
+                    const int y1 = Boundary::next(y0, h);
+
+                    offset00[i] = y0 * w + x0;
+                    offset01[i] = y0 * w + x1;
+                    offset10[i] = y1 * w + x0;
+                    offset11[i] = y1 * w + x1;
+                    weightX[i] = xBack - static_cast<float>(x0);
+                    weightY[i] = yBack - static_cast<float>(y0);
+                }
+
+                for (int c = 0; c < 3; ++c) {
+                    const S* src = field.data() + c * planeSize;
+                    S* dst = out.data() + c * planeSize + static_cast<size_t>(y) * w + xBegin;
+                    for (int i = 0; i < spanWidth; ++i) {
+                        const float fx = weightX[i];
+                        const float fy = weightY[i];
+                        const float top = storageToFloat(src[offset00[i]]) * (1.0f - fx) + storageToFloat(src[offset01[i]]) * fx;
+                        const float bottom = storageToFloat(src[offset10[i]]) * (1.0f - fx) + storageToFloat(src[offset11[i]]) * fx;
+                        dst[i] = floatToStorage<S>(top * (1.0f - fy) + bottom * fy);
+                    }
+                }
+            }
+        }
+    });
+}
+
+template <typename S>
+static void advectField(const FieldVector<S>& field, const FieldVector<S>& velocity, int width, int height,
+                        float dt, FieldVector<S>& out, ThreadPool& pool, bool wrap) {
+    withExtent(width == height ? width : kDynamicExtent, [&](auto extent) {
+        constexpr int kExtent = decltype(extent)::value;
+        if (wrap) {
+            advectFieldImpl<kExtent, WrapBoundary>(field, velocity, width, height, dt, out, pool);
+        } else {
+            advectFieldImpl<kExtent, ClampBoundary>(field, velocity, width, height, dt, out, pool);
+        }
+    });
+}
+
+// MacCormack corrector, fused with the blend and 8-bit pack. The forward
+// pass carried the field to phi1 and the backward pass returned it to phi2;
+// half the round-trip error is added back to phi1 and the result is clamped
+// to the min/max of the four source samples the forward backtrace read, so
+// the correction can sharpen but never ring past the local extrema.
+template <int kExtent, typename Boundary, typename S>
+static void maccormackBlendConvertImpl(const FieldVector<S>& field, const FieldVector<S>& forward,
+                                       const FieldVector<S>& back, const FieldVector<S>& baseField,
+                                       const FieldVector<S>& velocity, int widthIn, int heightIn, float dt,
+                                       float keepWeight, float baseWeight, FieldVector<S>& out,
+                                       unsigned char* rgb, ThreadPool& pool) {
+    const int w = kExtent == kDynamicExtent ? widthIn : kExtent;
+    const int h = kExtent == kDynamicExtent ? heightIn : kExtent;
+    out.resize(field.size());
+    const size_t planeSize = static_cast<size_t>(w) * h;
+
+    pool.parallelFor(0, h, [&](int rowBegin, int rowEnd) {
+        int offset00[kAdvectSpanWidth];
+        int offset01[kAdvectSpanWidth];
+        int offset10[kAdvectSpanWidth];
+        int offset11[kAdvectSpanWidth];
+
+        for (int y = rowBegin; y < rowEnd; ++y) {
+            for (int xBegin = 0; xBegin < w; xBegin += kAdvectSpanWidth) {
+                const int spanWidth = std::min(kAdvectSpanWidth, w - xBegin);
+                for (int i = 0; i < spanWidth; ++i) {
+                    const int x = xBegin + i;
+                    const int idx = y * w + x;
+                    float xBack = static_cast<float>(x) - dt * storageToFloat(velocity[2 * idx + 0]);
+                    float yBack = static_cast<float>(y) - dt * storageToFloat(velocity[2 * idx + 1]);
+
+                    xBack = Boundary::coord(xBack, w);
+                    yBack = Boundary::coord(yBack, h);
+
+                    const int x0 = static_cast<int>(xBack);
+                    const int y0 = static_cast<int>(yBack);
+                    const int x1 = Boundary::next(x0, w);
+                    const int y1 = Boundary::next(y0, h);
+
+                    offset00[i] = y0 * w + x0;
+                    offset01[i] = y0 * w + x1;
+                    offset10[i] = y1 * w + x0;
+                    offset11[i] = y1 * w + x1;
+                }
+
+                const size_t rowOffset = static_cast<size_t>(y) * w + xBegin;
+                for (int c = 0; c < 3; ++c) {
+                    const S* src = field.data() + c * planeSize;
+                    const S* fwd = forward.data() + c * planeSize + rowOffset;
+                    const S* bwd = back.data() + c * planeSize + rowOffset;
+                    const S* center = src + rowOffset;
+                    const S* base = baseField.data() + c * planeSize + rowOffset;
+                    S* dst = out.data() + c * planeSize + rowOffset;
+                    unsigned char* rgbRow = rgb + 3 * rowOffset;
+                    for (int i = 0; i < spanWidth; ++i) {
+                        const float s00 = storageToFloat(src[offset00[i]]);
+                        const float s01 = storageToFloat(src[offset01[i]]);
+                        const float s10 = storageToFloat(src[offset10[i]]);
+                        const float s11 = storageToFloat(src[offset11[i]]);
+                        const float lo = std::min(std::min(s00, s01), std::min(s10, s11));
+                        const float hi = std::max(std::max(s00, s01), std::max(s10, s11));
+                        const float corrected = storageToFloat(fwd[i]) +
+                                                0.5f * (storageToFloat(center[i]) - storageToFloat(bwd[i]));
+                        const float limited = std::clamp(corrected, lo, hi);
+                        const float blended = keepWeight * limited + baseWeight * storageToFloat(base[i]);
+                        dst[i] = floatToStorage<S>(blended);
+                        rgbRow[3 * i + c] = static_cast<unsigned char>(std::clamp(blended, 0.0f, 255.0f));
+                    }
+                }
+            }
+        }
+    });
+}
+
+template <typename S>
+static void maccormackBlendConvert(const FieldVector<S>& field, const FieldVector<S>& forward,
+                                   const FieldVector<S>& back, const FieldVector<S>& baseField,
+                                   const FieldVector<S>& velocity, int width, int height, float dt,
+                                   float keepWeight, float baseWeight, FieldVector<S>& out,
+                                   unsigned char* rgb, ThreadPool& pool, bool wrap) {
+    withExtent(width == height ? width : kDynamicExtent, [&](auto extent) {
+        constexpr int kExtent = decltype(extent)::value;
+        if (wrap) {
+            maccormackBlendConvertImpl<kExtent, WrapBoundary>(field, forward, back, baseField, velocity,
+                                                              width, height, dt, keepWeight, baseWeight,
+                                                              out, rgb, pool);
+        } else {
+            maccormackBlendConvertImpl<kExtent, ClampBoundary>(field, forward, back, baseField, velocity,
+                                                               width, height, dt, keepWeight, baseWeight,
+                                                               out, rgb, pool);
+        }
+    });
+}
+
+// Pixel rectangle [x0, x1) x [y0, y1) used by the --roi preview path.
+struct PixelRect {
+    int x0 = 0;
+    int y0 = 0;
+    int x1 = 0;
+    int y1 = 0;
+};
+
+// --roi preview path: advances the dye only inside `rect`, the crop's
+// dependency cone for this step, and packs the crop itself into a
+// roi-sized frame with crop-local indexing. Pixels outside the cone keep
+// stale values; later steps never read them because the cone shrinks by at
+// least one backtrace reach per step.
+template <int kExtent, typename Boundary, typename S>
+static void advectBlendConvertRoiImpl(const FieldVector<S>& field, const FieldVector<S>& baseField,
+                                      const FieldVector<S>& velocity, int widthIn, int heightIn, float dt,
+                                      float keepWeight, float baseWeight, FieldVector<S>& out,
+                                      unsigned char* rgb, ThreadPool& pool, PixelRect rect, PixelRect roi) {
+    const int w = kExtent == kDynamicExtent ? widthIn : kExtent;
+    const int h = kExtent == kDynamicExtent ? heightIn : kExtent;
+    out.resize(field.size());
+    const size_t planeSize = static_cast<size_t>(w) * h;
+    const int roiW = roi.x1 - roi.x0;
+
+    pool.parallelFor(rect.y0, rect.y1, [&](int rowBegin, int rowEnd) {
+        int offset00[kAdvectSpanWidth];
+        int offset01[kAdvectSpanWidth];
+        int offset10[kAdvectSpanWidth];
+        int offset11[kAdvectSpanWidth];
+        float weightX[kAdvectSpanWidth];
+        float weightY[kAdvectSpanWidth];
+
+        for (int y = rowBegin; y < rowEnd; ++y) {
+            const bool rowInRoi = y >= roi.y0 && y < roi.y1;
+            for (int xBegin = rect.x0; xBegin < rect.x1; xBegin += kAdvectSpanWidth) {
+                const int spanWidth = std::min(kAdvectSpanWidth, rect.x1 - xBegin);
+                for (int i = 0; i < spanWidth; ++i) {
+                    const int x = xBegin + i;
+                    const int idx = y * w + x;
+                    float xBack = static_cast<float>(x) - dt * storageToFloat(velocity[2 * idx + 0]);
+                    float yBack = static_cast<float>(y) - dt * storageToFloat(velocity[2 * idx + 1]);
+
+                    xBack = Boundary::coord(xBack, w);
+                    yBack = Boundary::coord(yBack, h);
+
+                    const int x0 = static_cast<int>(xBack);
+                    const int y0 = static_cast<int>(yBack);
+                    const int x1 = Boundary::next(x0, w);
+                    const int y1 = Boundary::next(y0, h);
+
+                    offset00[i] = y0 * w + x0;
+                    offset01[i] = y0 * w + x1;
+                    offset10[i] = y1 * w + x0;
+                    offset11[i] = y1 * w + x1;
+                    weightX[i] = xBack - static_cast<float>(x0);
+                    weightY[i] = yBack - static_cast<float>(y0);
+                }
+
+                const size_t rowOffset = static_cast<size_t>(y) * w + xBegin;
+                for (int c = 0; c < 3; ++c) {
+                    const S* src = field.data() + c * planeSize;
+                    const S* base = baseField.data() + c * planeSize + rowOffset;
+                    S* dst = out.data() + c * planeSize + rowOffset;
+                    for (int i = 0; i < spanWidth; ++i) {
+                        const float fx = weightX[i];
+                        const float fy = weightY[i];
+                        const float top = storageToFloat(src[offset00[i]]) * (1.0f - fx) + storageToFloat(src[offset01[i]]) * fx;
+                        const float bottom = storageToFloat(src[offset10[i]]) * (1.0f - fx) + storageToFloat(src[offset11[i]]) * fx;
+                        const float advected = top * (1.0f - fy) + bottom * fy;
+                        const float blended = keepWeight * advected + baseWeight * storageToFloat(base[i]);
+                        dst[i] = floatToStorage<S>(blended);
+                        const int x = xBegin + i;
+                        if (rowInRoi && x >= roi.x0 && x < roi.x1) {
+                            const size_t cropIdx = static_cast<size_t>(y - roi.y0) * roiW + (x - roi.x0);
+                            rgb[3 * cropIdx + c] = static_cast<unsigned char>(std::clamp(blended, 0.0f, 255.0f));
+                        }
+                    }
+                }
+            }
+        }
+    });
+}
+
+template <typename S>
+static void advectBlendConvertRoi(const FieldVector<S>& field, const FieldVector<S>& baseField,
+                                  const FieldVector<S>& velocity, int width, int height, float dt,
+                                  float keepWeight, float baseWeight, FieldVector<S>& out,
+                                  unsigned char* rgb, ThreadPool& pool, bool wrap, PixelRect rect, PixelRect roi) {
+    withExtent(width == height ? width : kDynamicExtent, [&](auto extent) {
+        constexpr int kExtent = decltype(extent)::value;
+        if (wrap) {
+            advectBlendConvertRoiImpl<kExtent, WrapBoundary>(field, baseField, velocity, width, height, dt,
+                                                             keepWeight, baseWeight, out, rgb, pool, rect, roi);
+        } else {
+            advectBlendConvertRoiImpl<kExtent, ClampBoundary>(field, baseField, velocity, width, height, dt,
+                                                              keepWeight, baseWeight, out, rgb, pool, rect, roi);
+        }
+    });
+}
+
+// The dye field is stored planar (three n*n channel planes) so the advection
+// gathers and the blur run over contiguous single-channel memory. The noise
+// pass stays serial (the RNG draw order defines the image); the vignette and
+// pack pass runs on the pool so the persistent buffer is first-touched by
+// the workers that will process each band.
+template <typename S>
+static FieldVector<S> createInitialDye(const Config& cfg, ThreadPool& pool) {
+    const int n = cfg.resolution;
+    const size_t planeSize = static_cast<size_t>(n) * n;
+    std::vector<float> dye(planeSize * 3);
+    std::mt19937 rng(42);
+    std::normal_distribution<float> noise(0.0f, 20.0f);
+
+    for (int y = 0; y < n; ++y) {
+        for (int x = 0; x < n; ++x) {
+            const size_t idx = static_cast<size_t>(y) * n + x;
+            dye[idx] = 30.0f + noise(rng);
+            dye[planeSize + idx] = 90.0f + noise(rng);
+            dye[2 * planeSize + idx] = 180.0f + noise(rng);
+        }
+    }
+
+    FieldVector<S> out(dye.size());
+    pool.parallelFor(0, n, [&](int rowBegin, int rowEnd) {
+        for (int y = rowBegin; y < rowEnd; ++y) {
+            for (int x = 0; x < n; ++x) {
+                const size_t idx = static_cast<size_t>(y) * n + x;
+                const float nx = (static_cast<float>(x) / (n - 1)) * 2.0f - 1.0f;
+                const float ny = (static_cast<float>(y) / (n - 1)) * 2.0f - 1.0f;
+                const float vignette = std::clamp(1.0f - 0.8f * std::hypot(nx, ny), 0.2f, 1.0f);
+                out[idx] = floatToStorage<S>(std::clamp(dye[idx] * vignette, 0.0f, 255.0f));
+                out[planeSize + idx] = floatToStorage<S>(std::clamp(dye[planeSize + idx] * vignette, 0.0f, 255.0f));
+                out[2 * planeSize + idx] = floatToStorage<S>(std::clamp(dye[2 * planeSize + idx] * vignette, 0.0f, 255.0f));
+            }
+        }
+    });
+
+    return out;
+}
+
+// Semi-Lagrangian advection over the planar dye field, processed in column
+// tiles. Phase one computes the backtraced sample indices and bilinear
+// weights for a whole tile in a branch-light loop the compiler vectorizes;
+// phase two replays those indices over each channel plane, so the gather
+// bookkeeping is paid once per pixel instead of once per sample.
+template <int kExtent>
+static void advectImpl(const FieldVector<float>& field, const FieldVector<float>& velocity, int widthIn, int heightIn, float dt, FieldVector<float>& out, ThreadPool& pool) {
+    const int width = kExtent == kDynamicExtent ? widthIn : kExtent;
+    const int height = kExtent == kDynamicExtent ? heightIn : kExtent;
+    out.resize(field.size());
+    const size_t planeSize = static_cast<size_t>(width) * height;
+    constexpr int kTileWidth = 128;
+
+    pool.parallelFor(0, height, [&](int rowBegin, int rowEnd) {
+        int offset00[kTileWidth];
+        int offset01[kTileWidth];
+        int offset10[kTileWidth];
+        int offset11[kTileWidth];
+        float weightX[kTileWidth];
+        float weightY[kTileWidth];
+
+        for (int y = rowBegin; y < rowEnd; ++y) {
+            for (int tileX = 0; tileX < width; tileX += kTileWidth) {
+                const int tileWidth = std::min(kTileWidth, width - tileX);
+
+                for (int i = 0; i < tileWidth; ++i) {
+                    const int x = tileX + i;
+                    const int idx = y * width + x;
+                    float xBack = static_cast<float>(x) - dt * velocity[2 * idx + 0];
+                    float yBack = static_cast<float>(y) - dt * velocity[2 * idx + 1];
+
+                    xBack = std::clamp(xBack, 0.0f, static_cast<float>(width - 1));
+                    yBack = std::clamp(yBack, 0.0f, static_cast<float>(height - 1));
+
+                    // Coordinates are non-negative after the clamp, so the
+                    // truncating cast is the floor.
+                    const int x0 = static_cast<int>(xBack);
+                    const int y0 = static_cast<int>(yBack);
+                    const int x1 = std::min(x0 + 1, width - 1);
+                    const int y1 = std::min(y0 + 1, height - 1);
+
+                    offset00[i] = y0 * width + x0;
+                    offset01[i] = y0 * width + x1;
+                    offset10[i] = y1 * width + x0;
+                    offset11[i] = y1 * width + x1;
+                    weightX[i] = xBack - static_cast<float>(x0);
+                    weightY[i] = yBack - static_cast<float>(y0);
+                }
+
+                for (int c = 0; c < 3; ++c) {
+                    const float* src = field.data() + c * planeSize;
+                    float* dst = out.data() + c * planeSize + static_cast<size_t>(y) * width + tileX;
+                    for (int i = 0; i < tileWidth; ++i) {
+                        const float fx = weightX[i];
+                        const float fy = weightY[i];
+                        const float top = src[offset00[i]] * (1.0f - fx) + src[offset01[i]] * fx;
+                        const float bottom = src[offset10[i]] * (1.0f - fx) + src[offset11[i]] * fx;
+                        dst[i] = top * (1.0f - fy) + bottom * fy;
+                    }
+                }
+            }
+        }
+    });
+}
+
+static void advect(const FieldVector<float>& field, const FieldVector<float>& velocity, int width, int height, float dt, FieldVector<float>& out, ThreadPool& pool) {
+    withExtent(width == height ? width : kDynamicExtent, [&](auto extent) {
+        advectImpl<decltype(extent)::value>(field, velocity, width, height, dt, out, pool);
+    });
+}
+
+// Bilinear, center-aligned upsample of a 2-channel coarse velocity grid to
+// the dye resolution. The finite-difference scale in buildVelocityField is
+// proportional to 1/gridsize times gridsize, so coarse-grid velocities are
+// already expressed in dye-pixel units and need no rescaling here.
+template <typename S>
+static void upsampleVelocity(const FieldVector<S>& coarse, int coarseN, int fineN,
+                             FieldVector<S>& fine, ThreadPool& pool) {
+    fine.resize(static_cast<size_t>(fineN) * fineN * 2);
+    const float scale = static_cast<float>(coarseN) / static_cast<float>(fineN);
+    pool.parallelFor(0, fineN, [&](int rowBegin, int rowEnd) {
+        for (int y = rowBegin; y < rowEnd; ++y) {
+            const float yc = std::clamp((static_cast<float>(y) + 0.5f) * scale - 0.5f, 0.0f, static_cast<float>(coarseN - 1));
+            const int y0 = static_cast<int>(yc);
+            const int y1 = std::min(y0 + 1, coarseN - 1);
+            const float fy = yc - static_cast<float>(y0);
+            for (int x = 0; x < fineN; ++x) {
+                const float xc = std::clamp((static_cast<float>(x) + 0.5f) * scale - 0.5f, 0.0f, static_cast<float>(coarseN - 1));
+                const int x0 = static_cast<int>(xc);
+                const int x1 = std::min(x0 + 1, coarseN - 1);
+                const float fx = xc - static_cast<float>(x0);
+                for (int c = 0; c < 2; ++c) {
+                    const float top = storageToFloat(coarse[2 * (y0 * coarseN + x0) + c]) * (1.0f - fx) +
+                                      storageToFloat(coarse[2 * (y0 * coarseN + x1) + c]) * fx;
+                    const float bottom = storageToFloat(coarse[2 * (y1 * coarseN + x0) + c]) * (1.0f - fx) +
+                                         storageToFloat(coarse[2 * (y1 * coarseN + x1) + c]) * fx;
+                    fine[2 * (static_cast<size_t>(y) * fineN + x) + c] = floatToStorage<S>(top * (1.0f - fy) + bottom * fy);
+                }
+            }
+        }
+    });
+}
+
+// Vorticity confinement (--vorticity=eps): re-amplifies the small-scale
+// rotation the velocity blur smooths away, so lower resolutions keep the
+// lively look that otherwise needs a finer grid. Stage one writes the scalar
+// curl into a scratch plane; stage two normalizes the gradient of the curl
+// magnitude and pushes each velocity sample perpendicular to it, scaled by
+// eps and the local curl. The normalize and apply work is fused into one
+// pass over the field, and like the psi/curl pair the two stages run
+// barrier-free since the gradient stencil only reaches one row up and down.
+template <typename S>
+static void applyVorticityConfinement(const Config& cfg, FieldVector<S>& velocity, SimBuffers& buffers,
+                                      ThreadPool& pool) {
+    const int n = cfg.resolution;
+    const float eps = cfg.vorticity;
+    FieldVector<float>& curl = buffers.blurPlane;  // free between velocity builds
+
+    const auto run = [&](auto boundary) {
+        using Boundary = decltype(boundary);
+        const auto curlRows = [&](int rowBegin, int rowEnd) {
+            for (int y = rowBegin; y < rowEnd; ++y) {
+                const int yp = Boundary::index(y + 1, n);
+                const int ym = Boundary::index(y - 1, n);
+                for (int x = 0; x < n; ++x) {
+                    const int xp = Boundary::index(x + 1, n);
+                    const int xm = Boundary::index(x - 1, n);
+                    const float dv_dx = storageToFloat(velocity[2 * (y * n + xp) + 1]) -
+                                        storageToFloat(velocity[2 * (y * n + xm) + 1]);
+                    const float du_dy = storageToFloat(velocity[2 * (yp * n + x) + 0]) -
+                                        storageToFloat(velocity[2 * (ym * n + x) + 0]);
+                    curl[y * n + x] = dv_dx - du_dy;
+                }
+            }
+        };
+        const auto confineRows = [&](int rowBegin, int rowEnd) {
+            for (int y = rowBegin; y < rowEnd; ++y) {
+                const int yp = Boundary::index(y + 1, n);
+                const int ym = Boundary::index(y - 1, n);
+                for (int x = 0; x < n; ++x) {
+                    const int xp = Boundary::index(x + 1, n);
+                    const int xm = Boundary::index(x - 1, n);
+                    const float gx = std::abs(curl[y * n + xp]) - std::abs(curl[y * n + xm]);
+                    const float gy = std::abs(curl[yp * n + x]) - std::abs(curl[ym * n + x]);
+                    // The small bias keeps flat regions (zero gradient) inert
+                    // instead of dividing by zero.
+                    const float mag = std::sqrt(gx * gx + gy * gy) + 1e-6f;
+                    const float push = eps * curl[y * n + x] / mag;
+                    const size_t idx = 2 * (static_cast<size_t>(y) * n + x);
+                    velocity[idx + 0] = floatToStorage<S>(storageToFloat(velocity[idx + 0]) + gy * push);
+                    velocity[idx + 1] = floatToStorage<S>(storageToFloat(velocity[idx + 1]) - gx * push);
+                }
+            }
+        };
+        runDependentStages(n, 1, cfg.wrapBoundary, pool, curlRows, confineRows);
+    };
+    if (cfg.wrapBoundary) {
+        run(WrapBoundary{});
+    } else {
+        run(ClampBoundary{});
+    }
+}
+
+static double timeSeconds(const std::function<void()>& fn) {
+    const auto start = std::chrono::steady_clock::now();
+    fn();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Times each kernel in isolation over the benchmark resolution matrix and
+// prints one JSON record per kernel/resolution pair. The bytes-per-step
+// figures are the approximate streamed working-set traffic of each kernel,
+// so gb_per_s is an effective-bandwidth estimate, not a bus measurement.
+static int runBenchmark(const Config& base, ThreadPool& pool) {
+    std::cout << "[\n";
+    bool firstRecord = true;
+    const auto emit = [&](const char* kernel, int n, double secondsPerStep, double bytesPerStep) {
+        const double pixels = static_cast<double>(n) * n;
+        if (!firstRecord) {
+            std::cout << ",\n";
+        }
+        firstRecord = false;
+        std::cout << "  {\"kernel\": \"" << kernel << "\", \"resolution\": " << n
+                  << ", \"ms_per_step\": " << secondsPerStep * 1e3
+                  << ", \"ns_per_pixel\": " << secondsPerStep * 1e9 / pixels
+                  << ", \"gb_per_s\": " << bytesPerStep / secondsPerStep / 1e9 << "}";
+    };
+
+    for (const int n : base.benchResolutions) {
+        Config cfg = base;
+        cfg.resolution = n;
+        SimBuffers buffers(n);
+        const size_t planeSize = static_cast<size_t>(n) * n;
+        FieldVector<float> velocity(planeSize * 2);
+        FieldVector<float> dye = createInitialDye<float>(cfg, pool);
+        FieldVector<float> tempDye(dye.size());
+        constexpr int kIters = 5;
+
+        buildVelocityField(cfg, 0.5f, velocity, buffers, pool);
+        double seconds = timeSeconds([&] {
+            for (int i = 0; i < kIters; ++i) {
+                buildVelocityField(cfg, 0.5f + 0.01f * static_cast<float>(i), velocity, buffers, pool);
+            }
+        }) / kIters;
+        emit("buildVelocityField", n, seconds, 16.0 * static_cast<double>(planeSize));
+
+        gaussianBlur(velocity, n, n, 2, cfg.blurSigma, cfg.boxBlur, cfg.wrapBoundary, buffers, pool);
+        seconds = timeSeconds([&] {
+            for (int i = 0; i < kIters; ++i) {
+                gaussianBlur(velocity, n, n, 2, cfg.blurSigma, cfg.boxBlur, cfg.wrapBoundary, buffers, pool);
+            }
+        }) / kIters;
+        emit("gaussianBlur", n, seconds, 64.0 * static_cast<double>(planeSize));
+
+        advect(dye, velocity, n, n, cfg.dt, tempDye, pool);
+        seconds = timeSeconds([&] {
+            for (int i = 0; i < kIters; ++i) {
+                advect(dye, velocity, n, n, cfg.dt, tempDye, pool);
+            }
+        }) / kIters;
+        emit("advect", n, seconds, 68.0 * static_cast<double>(planeSize));
+
+        std::vector<unsigned char> rgb(planeSize * 3);
+        seconds = timeSeconds([&] {
+            for (int i = 0; i < kIters; ++i) {
+                pool.parallelFor(0, n, [&](int rowBegin, int rowEnd) {
+                    for (size_t p = static_cast<size_t>(rowBegin) * n; p < static_cast<size_t>(rowEnd) * n; ++p) {
+                        rgb[3 * p + 0] = static_cast<unsigned char>(std::clamp(tempDye[p], 0.0f, 255.0f));
+                        rgb[3 * p + 1] = static_cast<unsigned char>(std::clamp(tempDye[planeSize + p], 0.0f, 255.0f));
+                        rgb[3 * p + 2] = static_cast<unsigned char>(std::clamp(tempDye[2 * planeSize + p], 0.0f, 255.0f));
+                    }
+                });
+            }
+        }) / kIters;
+        emit("convertToRgb8", n, seconds, 15.0 * static_cast<double>(planeSize));
+    }
+    std::cout << "\n]\n";
+    return 0;
+}
+
+// ULP distance between two fp32 values: adjacent representable floats are 1
+// apart, +0 and -0 are 0 apart. The bit patterns are remapped so the integer
+// distance is monotone across zero.
+static int64_t ulpDistance(float a, float b) {
+    const auto canonical = [](float v) {
+        int32_t bits;
+        std::memcpy(&bits, &v, sizeof(bits));
+        return bits >= 0 ? static_cast<int64_t>(bits)
+                         : static_cast<int64_t>(std::numeric_limits<int32_t>::min()) - bits;
+    };
+    return std::abs(canonical(a) - canonical(b));
+}
+
+// FNV-1a over a byte buffer; used by --checksum to fingerprint each frame.
+static uint64_t fnv1a(const unsigned char* data, size_t size) {
+    uint64_t hash = 1469598103934665603ull;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ data[i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+// Runs the production kernels and a straightforward scalar fp32 reference
+// side by side on the seeded initial state (the fixed mt19937(42) dye) and
+// reports the worst divergence per stage. Every step the reference recomputes
+// each stage from the production pipeline's own inputs, so the numbers are
+// per-stage error, not compounded drift. The run honours whatever the flags
+// select (fast-math, box blur, wrap, thread count), which is exactly what
+// makes the report meaningful before accepting an aggressive kernel.
+static int runVerify(const Config& cfg) {
+    const int n = cfg.resolution;
+    const size_t planeSize = static_cast<size_t>(n) * n;
+    ThreadPool pool(cfg.threads, cfg.pinThreads);
+    SimBuffers buffers(n);
+    FieldVector<float> dye = createInitialDye<float>(cfg, pool);
+    const FieldVector<float> baseDye = dye;
+    FieldVector<float> tempDye(dye.size());
+    FieldVector<float> velocity(planeSize * 2);
+    FieldVector<float> blurInput(planeSize * 2);
+    std::vector<unsigned char> rgb(planeSize * 3);
+
+    std::vector<float> refField(planeSize * 2);
+    std::vector<float> refTemp(planeSize * 2);
+    std::vector<float> refDye(dye.size());
+    std::vector<unsigned char> refRgb(rgb.size());
+
+    const auto index = [&](int i) {
+        return cfg.wrapBoundary ? WrapBoundary::index(i, n) : ClampBoundary::index(i, n);
+    };
+
+    // Scalar psi + curl with the precise stream function; the production side
+    // may run fast-math or AVX2 rows, and that difference is the point.
+    const auto referenceVelocity = [&](float t, std::vector<float>& out) {
+        std::vector<float> psi(planeSize);
+        for (int y = 0; y < n; ++y) {
+            for (int x = 0; x < n; ++x) {
+                psi[y * n + x] = streamFunction(static_cast<float>(x) / static_cast<float>(n),
+                                                static_cast<float>(y) / static_cast<float>(n), t);
+            }
+        }
+        const float scale = cfg.strength * static_cast<float>(n) * 0.5f;
+        for (int y = 0; y < n; ++y) {
+            for (int x = 0; x < n; ++x) {
+                const float dpsi_dx = psi[y * n + index(x + 1)] - psi[y * n + index(x - 1)];
+                const float dpsi_dy = psi[index(y + 1) * n + x] - psi[index(y - 1) * n + x];
+                out[2 * (y * n + x) + 0] = dpsi_dy * scale;
+                out[2 * (y * n + x) + 1] = -dpsi_dx * scale;
+            }
+        }
+    };
+
+    // Direct separable convolution (or direct box averages): O(radius) per
+    // pixel, no running sums, no band scheduling.
+    const auto referenceBlur = [&](std::vector<float>& field) {
+        if (cfg.blurSigma <= 0.0f) {
+            return;
+        }
+        const auto horizontal = [&](const std::vector<float>& src, std::vector<float>& dst, int channel,
+                                    const float* kernel, int radius, float flat) {
+            for (int y = 0; y < n; ++y) {
+                for (int x = 0; x < n; ++x) {
+                    float accum = 0.0f;
+                    for (int k = -radius; k <= radius; ++k) {
+                        accum += src[2 * (y * n + index(x + k)) + channel] * (kernel != nullptr ? kernel[k + radius] : flat);
+                    }
+                    dst[2 * (y * n + x) + channel] = accum;
+                }
+            }
+        };
+        const auto vertical = [&](const std::vector<float>& src, std::vector<float>& dst, int channel,
+                                  const float* kernel, int radius, float flat) {
+            for (int y = 0; y < n; ++y) {
+                for (int x = 0; x < n; ++x) {
+                    float accum = 0.0f;
+                    for (int k = -radius; k <= radius; ++k) {
+                        accum += src[2 * (index(y + k) * n + x) + channel] * (kernel != nullptr ? kernel[k + radius] : flat);
+                    }
+                    dst[2 * (y * n + x) + channel] = accum;
+                }
+            }
+        };
+        if (cfg.boxBlur) {
+            int radii[3] = {0, 0, 0};
+            boxRadiiForSigma(cfg.blurSigma, radii);
+            for (int pass = 0; pass < 3; ++pass) {
+                const float flat = 1.0f / static_cast<float>(2 * radii[pass] + 1);
+                for (int c = 0; c < 2; ++c) {
+                    horizontal(field, refTemp, c, nullptr, radii[pass], flat);
+                    vertical(refTemp, field, c, nullptr, radii[pass], flat);
+                }
+            }
+        } else {
+            const int radius = std::max(1, static_cast<int>(cfg.blurSigma * 3.0f));
+            std::vector<float> kernel(2 * radius + 1);
+            float sum = 0.0f;
+            for (int i = -radius; i <= radius; ++i) {
+                kernel[i + radius] = std::exp(-(i * i) / (2.0f * cfg.blurSigma * cfg.blurSigma));
+                sum += kernel[i + radius];
+            }
+            for (float& v : kernel) {
+                v /= sum;
+            }
+            for (int c = 0; c < 2; ++c) {
+                horizontal(field, refTemp, c, kernel.data(), radius, 0.0f);
+                vertical(refTemp, field, c, kernel.data(), radius, 0.0f);
+            }
+        }
+    };
+
+    // Scalar fused advect/blend/pack, one pixel at a time.
+    const auto referenceAdvect = [&] {
+        for (int y = 0; y < n; ++y) {
+            for (int x = 0; x < n; ++x) {
+                const int idx = y * n + x;
+                float xBack = static_cast<float>(x) - cfg.dt * velocity[2 * idx + 0];
+                float yBack = static_cast<float>(y) - cfg.dt * velocity[2 * idx + 1];
+                xBack = cfg.wrapBoundary ? WrapBoundary::coord(xBack, n) : ClampBoundary::coord(xBack, n);
+                yBack = cfg.wrapBoundary ? WrapBoundary::coord(yBack, n) : ClampBoundary::coord(yBack, n);
+                const int x0 = static_cast<int>(xBack);
+                const int y0 = static_cast<int>(yBack);
+                const int x1 = cfg.wrapBoundary ? WrapBoundary::next(x0, n) : ClampBoundary::next(x0, n);
+                const int y1 = cfg.wrapBoundary ? WrapBoundary::next(y0, n) : ClampBoundary::next(y0, n);
+                const float fx = xBack - static_cast<float>(x0);
+                const float fy = yBack - static_cast<float>(y0);
+                for (int c = 0; c < 3; ++c) {
+                    const float* src = dye.data() + c * planeSize;
+                    const float top = src[y0 * n + x0] * (1.0f - fx) + src[y0 * n + x1] * fx;
+                    const float bottom = src[y1 * n + x0] * (1.0f - fx) + src[y1 * n + x1] * fx;
+                    const float advected = top * (1.0f - fy) + bottom * fy;
+                    const float blended = 0.995f * advected + 0.005f * baseDye[c * planeSize + idx];
+                    refDye[c * planeSize + idx] = blended;
+                    refRgb[3 * idx + c] = static_cast<unsigned char>(std::clamp(blended, 0.0f, 255.0f));
+                }
+            }
+        }
+    };
+
+    struct StageDivergence {
+        int64_t maxUlp = 0;
+        double maxAbs = 0.0;
+        void update(float got, float want) {
+            maxUlp = std::max(maxUlp, ulpDistance(got, want));
+            maxAbs = std::max(maxAbs, static_cast<double>(std::abs(got - want)));
+        }
+    };
+    StageDivergence velocityDiv;
+    StageDivergence blurDiv;
+    StageDivergence advectDiv;
+    int rgbMax = 0;
+
+    // A handful of steps covers the whole phase space of the periodic stream
+    // function; long renders repeat the same kernel inputs.
+    const int steps = std::min(cfg.steps, 30);
+    for (int step = 0; step < steps; ++step) {
+        const float t = static_cast<float>(step) / static_cast<float>(cfg.steps) * 6.0f;
+
+        buildVelocityField(cfg, t, velocity, buffers, pool);
+        referenceVelocity(t, refField);
+        for (size_t i = 0; i < planeSize * 2; ++i) {
+            velocityDiv.update(velocity[i], refField[i]);
+        }
+
+        // Both sides blur the production field so the stage is isolated.
+        std::copy(velocity.begin(), velocity.end(), blurInput.begin());
+        std::copy(velocity.begin(), velocity.end(), refField.begin());
+        gaussianBlur(blurInput, n, n, 2, cfg.blurSigma, cfg.boxBlur, cfg.wrapBoundary, buffers, pool);
+        referenceBlur(refField);
+        for (size_t i = 0; i < planeSize * 2; ++i) {
+            blurDiv.update(blurInput[i], refField[i]);
+        }
+
+        velocity.swap(blurInput);
+        advectBlendConvert(dye, baseDye, velocity, n, n, cfg.dt, 0.995f, 0.005f, tempDye, rgb.data(), pool,
+                           cfg.wrapBoundary, nullptr);
+        referenceAdvect();
+        for (size_t i = 0; i < dye.size(); ++i) {
+            advectDiv.update(tempDye[i], refDye[i]);
+        }
+        for (size_t i = 0; i < rgb.size(); ++i) {
+            rgbMax = std::max(rgbMax, std::abs(static_cast<int>(rgb[i]) - static_cast<int>(refRgb[i])));
+        }
+        dye.swap(tempDye);
+        if (cfg.checksum) {
+            std::cout << "Checksum step " << step << ": " << std::hex << fnv1a(rgb.data(), rgb.size())
+                      << std::dec << "\n";
+        }
+    }
+
+    std::cout << "Verification over " << steps << " steps at " << n << "x" << n
+              << " (reference: scalar fp32, precise sin/cos):\n";
+    const auto report = [](const char* stage, const StageDivergence& d) {
+        std::cout << "  " << stage << " max " << d.maxUlp << " ulp, max abs " << d.maxAbs << "\n";
+    };
+    report("velocity", velocityDiv);
+    report("blur    ", blurDiv);
+    report("advect  ", advectDiv);
+    std::cout << "  rgb      max " << rgbMax << " levels\n";
+
+    // Fast-math and the box-blur chain trade accuracy for speed by design;
+    // everything else is expected to track the reference to within rounding.
+    const int rgbTolerance = cfg.fastMath ? 3 : (cfg.boxBlur ? 1 : 0);
+    if (rgbMax > rgbTolerance) {
+        std::cout << "FAIL: rgb diverges by " << rgbMax << " levels (tolerance " << rgbTolerance << ").\n";
+        return 1;
+    }
+    std::cout << "PASS: rgb within " << rgbTolerance << " levels of the scalar reference.\n";
+    return 0;
+}
+
+static Config applyOverrides(Config cfg, const std::vector<std::string>& args) {
+    for (const auto& raw : args) {
+        if (raw.rfind("--", 0) != 0) {
+            std::cerr << "Ignoring argument '" << raw << "'. Use --key=value format or --no-live-view.\n";
+            continue;
+        }
+        const std::string keyValue = raw.substr(2);
+        if (keyValue == "no-live-view") {
+            cfg.liveView = false;
+            continue;
+        }
+        if (keyValue == "profile") {
+            cfg.profile = true;
+            continue;
+        }
+        if (keyValue == "bench") {
+            cfg.bench = true;
+            continue;
+        }
+        if (keyValue == "tile-skip") {
+            cfg.tileSkip = true;
+            continue;
+        }
+        if (keyValue == "pin-threads") {
+            cfg.pinThreads = true;
+            continue;
+        }
+        if (keyValue == "verify") {
+            cfg.verify = true;
+            continue;
+        }
+        if (keyValue == "checksum") {
+            cfg.checksum = true;
+            continue;
+        }
+        const auto pos = keyValue.find('=');
+        if (pos == std::string::npos) {
+            std::cerr << "Ignoring argument '--" << keyValue << "'. Expected --key=value format or --no-live-view.\n";
+            continue;
+        }
+        const std::string key = keyValue.substr(0, pos);
+        const std::string value = keyValue.substr(pos + 1);
+        try {
+            if (key == "steps") {
+                cfg.steps = std::stoi(value);
+            } else if (key == "resolution") {
+                cfg.resolution = std::stoi(value);
+            } else if (key == "dt") {
+                cfg.dt = std::stof(value);
+            } else if (key == "strength") {
+                cfg.strength = std::stof(value);
+            } else if (key == "gif-name") {
+                cfg.gifName = value;
+            } else if (key == "output-dir") {
+                cfg.outputDir = value;
+            } else if (key == "fps") {
+                cfg.fps = std::stoi(value);
+            } else if (key == "threads") {
+                cfg.threads = std::stoi(value);
+            } else if (key == "blur-sigma") {
+                cfg.blurSigma = std::stof(value);
+            } else if (key == "vorticity") {
+                cfg.vorticity = std::max(0.0f, std::stof(value));
+            } else if (key == "roi") {
+                int parts[4] = {0, 0, 0, 0};
+                std::string list = value;
+                int count = 0;
+                size_t comma;
+                while (count < 3 && (comma = list.find(',')) != std::string::npos) {
+                    parts[count++] = std::stoi(list.substr(0, comma));
+                    list.erase(0, comma + 1);
+                }
+                parts[count++] = std::stoi(list);
+                if (count == 4 && parts[2] > 0 && parts[3] > 0) {
+                    cfg.roiX = parts[0];
+                    cfg.roiY = parts[1];
+                    cfg.roiW = parts[2];
+                    cfg.roiH = parts[3];
+                } else {
+                    std::cerr << "Invalid ROI '" << value << "'. Expected x,y,w,h with positive size.\n";
+                }
+            } else if (key == "emitter") {
+                std::string fields[5];
+                std::string list = value;
+                int count = 0;
+                size_t comma;
+                while (count < 4 && (comma = list.find(',')) != std::string::npos) {
+                    fields[count++] = list.substr(0, comma);
+                    list.erase(0, comma + 1);
+                }
+                fields[count++] = list;
+                if (count == 5) {
+                    Emitter e;
+                    e.x = std::stoi(fields[0]);
+                    e.y = std::stoi(fields[1]);
+                    e.radius = std::stoi(fields[2]);
+                    e.color = static_cast<unsigned>(std::stoul(fields[3], nullptr, 16));
+                    e.rate = std::stof(fields[4]);
+                    if (e.radius > 0 && e.rate > 0.0f && e.rate <= 1.0f) {
+                        cfg.emitters.push_back(e);
+                    } else {
+                        std::cerr << "Invalid emitter '" << value << "': radius must be positive, rate in (0, 1].\n";
+                    }
+                } else {
+                    std::cerr << "Invalid emitter '" << value << "'. Expected x,y,r,rrggbb,rate.\n";
+                }
+            } else if (key == "advect") {
+                if (value == "maccormack") {
+                    cfg.maccormack = true;
+                } else if (value == "semilagrangian") {
+                    cfg.maccormack = false;
+                } else {
+                    std::cerr << "Unknown advection scheme '" << value << "'. Expected semilagrangian or maccormack.\n";
+                }
+            } else if (key == "blur-mode") {
+                if (value == "box") {
+                    cfg.boxBlur = true;
+                } else if (value == "gaussian") {
+                    cfg.boxBlur = false;
+                } else {
+                    std::cerr << "Unknown blur mode '" << value << "'. Expected gaussian or box.\n";
+                }
+            } else if (key == "bench") {
+                cfg.bench = true;
+                cfg.benchResolutions.clear();
+                std::string list = value;
+                size_t comma;
+                while ((comma = list.find(',')) != std::string::npos) {
+                    cfg.benchResolutions.push_back(std::stoi(list.substr(0, comma)));
+                    list.erase(0, comma + 1);
+                }
+                if (!list.empty()) {
+                    cfg.benchResolutions.push_back(std::stoi(list));
+                }
+            } else if (key == "boundary") {
+                if (value == "wrap") {
+                    cfg.wrapBoundary = true;
+                } else if (value == "clamp") {
+                    cfg.wrapBoundary = false;
+                } else {
+                    std::cerr << "Unknown boundary '" << value << "'. Expected clamp or wrap.\n";
+                }
+            } else if (key == "velocity-scale") {
+                cfg.velocityScale = std::max(1, std::stoi(value));
+            } else if (key == "velocity-update-every") {
+                cfg.velocityUpdateEvery = std::max(1, std::stoi(value));
+            } else if (key == "velocity-cache") {
+                cfg.velocityCachePath = value;
+            } else if (key == "backend") {
+                if (value == "cpu" || value == "cuda") {
+                    cfg.backend = value;
+                } else {
+                    std::cerr << "Unknown backend '" << value << "'. Expected cpu or cuda.\n";
+                }
+            } else if (key == "checkpoint-every") {
+                cfg.checkpointEvery = std::max(0, std::stoi(value));
+            } else if (key == "resume") {
+                cfg.resumePath = value;
+            } else if (key == "frames") {
+                const size_t colon = value.find(':');
+                const int begin = colon == std::string::npos ? -1 : std::stoi(value.substr(0, colon));
+                const int end = colon == std::string::npos ? -1 : std::stoi(value.substr(colon + 1));
+                if (begin >= 0 && end > begin) {
+                    cfg.frameBegin = begin;
+                    cfg.frameEnd = end;
+                } else {
+                    std::cerr << "Invalid frame range '" << value << "'. Expected start:end with end > start >= 0.\n";
+                }
+            } else if (key == "merge") {
+                std::string list = value;
+                size_t comma;
+                while ((comma = list.find(',')) != std::string::npos) {
+                    cfg.mergePaths.push_back(list.substr(0, comma));
+                    list.erase(0, comma + 1);
+                }
+                if (!list.empty()) {
+                    cfg.mergePaths.push_back(list);
+                }
+            } else if (key == "sweep") {
+                cfg.sweepPath = value;
+            } else if (key == "trace") {
+                cfg.tracePath = value;
+            } else if (key == "storage") {
+                if (value == "fp16") {
+                    cfg.fp16Storage = true;
+                } else if (value == "fp32") {
+                    cfg.fp16Storage = false;
+                } else {
+                    std::cerr << "Unknown storage '" << value << "'. Expected fp32 or fp16.\n";
+                }
+            } else if (key == "output-format") {
+                if (value == "gif" || value == "raw" || value == "delta") {
+                    cfg.outputFormat = value;
+                } else {
+                    std::cerr << "Unknown output format '" << value << "'. Expected gif, raw, or delta.\n";
+                }
+            } else if (key == "decode-delta") {
+                cfg.decodeDeltaPath = value;
+            } else if (key == "output-mode") {
+                if (value == "streaming") {
+                    cfg.streamOutput = true;
+                } else if (value == "buffered") {
+                    cfg.streamOutput = false;
+                } else {
+                    std::cerr << "Unknown output mode '" << value << "'. Expected streaming or buffered.\n";
+                }
+            } else if (key == "precision") {
+                if (value == "fast") {
+                    cfg.fastMath = true;
+                } else if (value == "exact") {
+                    cfg.fastMath = false;
+                } else {
+                    std::cerr << "Unknown precision '" << value << "'. Expected fast or exact.\n";
+                }
+            } else {
+                std::cerr << "Unknown option '--" << key << "'.\n";
+            }
+        } catch (const std::exception& ex) {
+            std::cerr << "Failed to parse value for '--" << key << "': " << ex.what() << "\n";
+        }
+    }
+    return cfg;
+}
+
+// Incremental GIF89a encoder: a global 256-color palette is derived from the
+// first frame by median cut (the dye colors are temporally stable), and every
+// frame is mapped to it with ordered Bayer dithering in parallel on the
+// writer's own worker pool, then LZW-compressed and appended immediately.
+// Resident memory stays at one frame regardless of --steps. The buffered
+// Magick++ path remains the default.
+class StreamingGifWriter {
+public:
+    StreamingGifWriter(const std::string& path, int width, int height, size_t delayCs, int threads)
+        : width_(width), height_(height), delayCs_(delayCs), file_(path, std::ios::binary), pool_(threads) {}
+
+    bool valid() const { return static_cast<bool>(file_); }
+
+    void writeFrame(const unsigned char* rgb) {
+        if (!headerWritten_) {
+            buildPalette(rgb);
+            buildLookup();
+            writeHeader();
+            headerWritten_ = true;
+        }
+
+        indices_.resize(static_cast<size_t>(width_) * height_);
+        pool_.parallelFor(0, height_, [&](int rowBegin, int rowEnd) {
+            for (int y = rowBegin; y < rowEnd; ++y) {
+                const unsigned char* srcRow = rgb + 3 * static_cast<size_t>(y) * width_;
+                unsigned char* dstRow = indices_.data() + static_cast<size_t>(y) * width_;
+                const unsigned char* bayerRow = kBayer8[y & 7];
+                for (int x = 0; x < width_; ++x) {
+                    // Ordered dithering: a per-pixel threshold offset breaks
+                    // up banding before the 5-bit lookup quantization.
+                    const int offset = (static_cast<int>(bayerRow[x & 7]) - 32) / 4;
+                    const int r = std::clamp(static_cast<int>(srcRow[3 * x + 0]) + offset, 0, 255);
+                    const int g = std::clamp(static_cast<int>(srcRow[3 * x + 1]) + offset, 0, 255);
+                    const int b = std::clamp(static_cast<int>(srcRow[3 * x + 2]) + offset, 0, 255);
+                    dstRow[x] = lookup_[((r >> 3) << 10) | ((g >> 3) << 5) | (b >> 3)];
+                }
+            }
+        });
+
+        // Graphic control extension: keep the frame until the next one lands.
+        const unsigned char gce[] = {0x21, 0xF9, 0x04, 0x04,
+                                     static_cast<unsigned char>(delayCs_ & 0xFF),
+                                     static_cast<unsigned char>((delayCs_ >> 8) & 0xFF),
+                                     0x00, 0x00};
+        file_.write(reinterpret_cast<const char*>(gce), sizeof(gce));
+
+        unsigned char descriptor[10] = {0x2C, 0, 0, 0, 0, 0, 0, 0, 0, 0x00};
+        putLe16(descriptor + 5, width_);
+        putLe16(descriptor + 7, height_);
+        file_.write(reinterpret_cast<const char*>(descriptor), sizeof(descriptor));
+
+        writeLzwImage();
+        file_.flush();
+    }
+
+    void finish() {
+        const unsigned char trailer = 0x3B;
+        file_.write(reinterpret_cast<const char*>(&trailer), 1);
+        file_.flush();
+    }
+
+private:
+    static constexpr int kPaletteSize = 256;
+    static constexpr unsigned char kBayer8[8][8] = {
+        {0, 32, 8, 40, 2, 34, 10, 42},   {48, 16, 56, 24, 50, 18, 58, 26},
+        {12, 44, 4, 36, 14, 46, 6, 38},  {60, 28, 52, 20, 62, 30, 54, 22},
+        {3, 35, 11, 43, 1, 33, 9, 41},   {51, 19, 59, 27, 49, 17, 57, 25},
+        {15, 47, 7, 39, 13, 45, 5, 37},  {63, 31, 55, 23, 61, 29, 53, 21}};
+
+    static void putLe16(unsigned char* dst, int value) {
+        dst[0] = static_cast<unsigned char>(value & 0xFF);
+        dst[1] = static_cast<unsigned char>((value >> 8) & 0xFF);
+    }
+
+    // Median cut over a subsample of the first frame: repeatedly split the
+    // box with the widest channel range at its median until 256 boxes
+    // remain, then average each box into a palette entry.
+    void buildPalette(const unsigned char* rgb) {
+        const size_t pixelCount = static_cast<size_t>(width_) * height_;
+        const size_t stride = std::max<size_t>(1, pixelCount / 65536);
+        std::vector<std::array<unsigned char, 3>> samples;
+        samples.reserve(pixelCount / stride + 1);
+        for (size_t i = 0; i < pixelCount; i += stride) {
+            samples.push_back({rgb[3 * i + 0], rgb[3 * i + 1], rgb[3 * i + 2]});
+        }
+
+        struct Box {
+            size_t begin;
+            size_t end;
+        };
+        std::vector<Box> boxes = {{0, samples.size()}};
+        while (boxes.size() < kPaletteSize) {
+            // Split the box with the widest channel range.
+            size_t bestBox = boxes.size();
+            int bestRange = 0;
+            int bestChannel = 0;
+            for (size_t b = 0; b < boxes.size(); ++b) {
+                if (boxes[b].end - boxes[b].begin < 2) {
+                    continue;
+                }
+                for (int c = 0; c < 3; ++c) {
+                    int lo = 255;
+                    int hi = 0;
+                    for (size_t i = boxes[b].begin; i < boxes[b].end; ++i) {
+                        lo = std::min(lo, static_cast<int>(samples[i][c]));
+                        hi = std::max(hi, static_cast<int>(samples[i][c]));
+                    }
+                    if (hi - lo > bestRange) {
+                        bestRange = hi - lo;
+                        bestChannel = c;
+                        bestBox = b;
+                    }
+                }
+            }
+            if (bestBox == boxes.size()) {
+                break;  // every box is a single color
+            }
+            Box& box = boxes[bestBox];
+            const size_t mid = (box.begin + box.end) / 2;
+            std::nth_element(samples.begin() + box.begin, samples.begin() + mid, samples.begin() + box.end,
+                             [bestChannel](const std::array<unsigned char, 3>& a, const std::array<unsigned char, 3>& b) {
+                                 return a[bestChannel] < b[bestChannel];
+                             });
+            boxes.push_back({mid, box.end});
+            box.end = mid;
+        }
+
+        for (size_t b = 0; b < boxes.size(); ++b) {
+            size_t sum[3] = {0, 0, 0};
+            const size_t count = std::max<size_t>(1, boxes[b].end - boxes[b].begin);
+            for (size_t i = boxes[b].begin; i < boxes[b].end; ++i) {
+                for (int c = 0; c < 3; ++c) {
+                    sum[c] += samples[i][c];
+                }
+            }
+            for (int c = 0; c < 3; ++c) {
+                palette_[3 * b + c] = static_cast<unsigned char>(sum[c] / count);
+            }
+        }
+        paletteCount_ = static_cast<int>(boxes.size());
+    }
+
+    // Nearest-palette index for every cell of a 32x32x32 color cube, so the
+    // per-pixel mapping is a shift-and-or plus one table load.
+    void buildLookup() {
+        lookup_.resize(32 * 32 * 32);
+        pool_.parallelFor(0, 32, [&](int rBegin, int rEnd) {
+            for (int r = rBegin; r < rEnd; ++r) {
+                for (int g = 0; g < 32; ++g) {
+                    for (int b = 0; b < 32; ++b) {
+                        const int rc = r * 8 + 4;
+                        const int gc = g * 8 + 4;
+                        const int bc = b * 8 + 4;
+                        int best = 0;
+                        int bestDist = 1 << 30;
+                        for (int p = 0; p < paletteCount_; ++p) {
+                            const int dr = rc - palette_[3 * p + 0];
+                            const int dg = gc - palette_[3 * p + 1];
+                            const int db = bc - palette_[3 * p + 2];
+                            const int dist = dr * dr + dg * dg + db * db;
+                            if (dist < bestDist) {
+                                bestDist = dist;
+                                best = p;
+                            }
+                        }
+                        lookup_[(r << 10) | (g << 5) | b] = static_cast<unsigned char>(best);
+                    }
+                }
+            }
+        });
+    }
+
+    void writeHeader() {
+        file_.write("GIF89a", 6);
+        unsigned char screen[7] = {0, 0, 0, 0, 0xF7, 0x00, 0x00};  // 256-entry global table
+        putLe16(screen + 0, width_);
+        putLe16(screen + 2, height_);
+        file_.write(reinterpret_cast<const char*>(screen), sizeof(screen));
+        file_.write(reinterpret_cast<const char*>(palette_), sizeof(palette_));
+
+        // NETSCAPE looping extension: repeat forever, matching writeImages.
+        const unsigned char loop[] = {0x21, 0xFF, 0x0B, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E',
+                                      '2',  '.',  '0',  0x03, 0x01, 0x00, 0x00, 0x00};
+        file_.write(reinterpret_cast<const char*>(loop), sizeof(loop));
+    }
+
+    void emitCode(int code, int codeBits) {
+        bitBuffer_ |= static_cast<uint32_t>(code) << bitCount_;
+        bitCount_ += codeBits;
+        while (bitCount_ >= 8) {
+            chunk_.push_back(static_cast<unsigned char>(bitBuffer_ & 0xFF));
+            bitBuffer_ >>= 8;
+            bitCount_ -= 8;
+            if (chunk_.size() == 255) {
+                flushChunk();
+            }
+        }
+    }
+
+    void flushChunk() {
+        if (chunk_.empty()) {
+            return;
+        }
+        const unsigned char size = static_cast<unsigned char>(chunk_.size());
+        file_.write(reinterpret_cast<const char*>(&size), 1);
+        file_.write(reinterpret_cast<const char*>(chunk_.data()), chunk_.size());
+        chunk_.clear();
+    }
+
+    void writeLzwImage() {
+        constexpr int minCodeSize = 8;
+        constexpr int clearCode = 1 << minCodeSize;
+        constexpr int endCode = clearCode + 1;
+        constexpr int maxCode = 4096;
+
+        const unsigned char minCodeByte = minCodeSize;
+        file_.write(reinterpret_cast<const char*>(&minCodeByte), 1);
+
+        // children_[prefix * 256 + byte] maps an LZW string extension to its code.
+        children_.assign(static_cast<size_t>(maxCode) * 256, -1);
+        int nextCode = endCode + 1;
+        int codeBits = minCodeSize + 1;
+
+        emitCode(clearCode, codeBits);
+        int prefix = indices_[0];
+        for (size_t i = 1; i < indices_.size(); ++i) {
+            const int byte = indices_[i];
+            const size_t slot = static_cast<size_t>(prefix) * 256 + byte;
+            if (children_[slot] >= 0) {
+                prefix = children_[slot];
+                continue;
+            }
+            emitCode(prefix, codeBits);
+            children_[slot] = nextCode;
+            ++nextCode;
+            if (nextCode == maxCode) {
+                emitCode(clearCode, codeBits);
+                children_.assign(children_.size(), -1);
+                nextCode = endCode + 1;
+                codeBits = minCodeSize + 1;
+            } else if (nextCode == (1 << codeBits) + 1 && codeBits < 12) {
+                // Widen only after one more code goes out at the old width:
+                // decoders grow their table one entry behind the encoder.
+                ++codeBits;
+            }
+            prefix = byte;
+        }
+        emitCode(prefix, codeBits);
+        emitCode(endCode, codeBits);
+        if (bitCount_ > 0) {
+            chunk_.push_back(static_cast<unsigned char>(bitBuffer_ & 0xFF));
+            bitBuffer_ = 0;
+            bitCount_ = 0;
+        }
+        flushChunk();
+        const unsigned char terminator = 0x00;
+        file_.write(reinterpret_cast<const char*>(&terminator), 1);
+    }
+
+    int width_;
+    int height_;
+    size_t delayCs_;
+    std::ofstream file_;
+    ThreadPool pool_;
+    bool headerWritten_ = false;
+    unsigned char palette_[kPaletteSize * 3] = {};
+    int paletteCount_ = 0;
+    std::vector<unsigned char> lookup_;
+    std::vector<unsigned char> indices_;
+    std::vector<int> children_;
+    std::vector<unsigned char> chunk_;
+    uint32_t bitBuffer_ = 0;
+    int bitCount_ = 0;
+};
+
+// Raw frame dump: a fixed 24-byte header (magic, width, height, frame count,
+// fps as LE uint32) followed by contiguous RGB8 frames. On POSIX the whole
+// file is preallocated and memory-mapped so writeFrame is a plain memcpy into
+// the page cache; elsewhere it falls back to positioned stream writes.
+class RawFrameWriter {
+public:
+    RawFrameWriter(const std::string& path, int width, int height, int frameCount, int fps)
+        : frameBytes_(static_cast<size_t>(width) * height * 3),
+          totalBytes_(kHeaderBytes + frameBytes_ * static_cast<size_t>(frameCount)) {
+#ifndef _WIN32
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd_ < 0 || ::ftruncate(fd_, static_cast<off_t>(totalBytes_)) != 0) {
+            return;
+        }
+        void* map = ::mmap(nullptr, totalBytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (map == MAP_FAILED) {
+            return;
+        }
+        map_ = static_cast<unsigned char*>(map);
+#else
+        file_.open(path, std::ios::binary);
+        if (!file_) {
+            return;
+        }
+#endif
+        unsigned char header[kHeaderBytes] = {'W', 'F', 'L', 'O', 'W', 'R', 'A', 'W'};
+        putLe32(header + 8, width);
+        putLe32(header + 12, height);
+        putLe32(header + 16, frameCount);
+        putLe32(header + 20, fps);
+#ifndef _WIN32
+        std::copy(header, header + kHeaderBytes, map_);
+#else
+        file_.write(reinterpret_cast<const char*>(header), kHeaderBytes);
+#endif
+        valid_ = true;
+    }
+
+    RawFrameWriter(const RawFrameWriter&) = delete;
+    RawFrameWriter& operator=(const RawFrameWriter&) = delete;
+
+    ~RawFrameWriter() {
+#ifndef _WIN32
+        if (map_ != nullptr) {
+            ::munmap(map_, totalBytes_);
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+#endif
+    }
+
+    bool valid() const { return valid_; }
+    int framesWritten() const { return framesWritten_; }
+
+    void writeFrame(const unsigned char* rgb) {
+        const size_t offset = kHeaderBytes + frameBytes_ * static_cast<size_t>(framesWritten_);
+#ifndef _WIN32
+        std::copy(rgb, rgb + frameBytes_, map_ + offset);
+#else
+        file_.seekp(static_cast<std::streamoff>(offset));
+        file_.write(reinterpret_cast<const char*>(rgb), static_cast<std::streamsize>(frameBytes_));
+        valid_ = static_cast<bool>(file_);
+#endif
+        ++framesWritten_;
+    }
+
+    // Patches the header frame count and trims the preallocation if the run
+    // stopped early (live-view ESC).
+    void finish() {
+#ifndef _WIN32
+        putLe32(map_ + 16, framesWritten_);
+        const size_t usedBytes = kHeaderBytes + frameBytes_ * static_cast<size_t>(framesWritten_);
+        ::msync(map_, usedBytes, MS_ASYNC);
+        if (usedBytes < totalBytes_) {
+            valid_ = ::ftruncate(fd_, static_cast<off_t>(usedBytes)) == 0 && valid_;
+        }
+#else
+        unsigned char count[4];
+        putLe32(count, framesWritten_);
+        file_.seekp(16);
+        file_.write(reinterpret_cast<const char*>(count), 4);
+        file_.flush();
+        valid_ = static_cast<bool>(file_);
+#endif
+    }
+
+private:
+    static constexpr size_t kHeaderBytes = 24;
+
+    static void putLe32(unsigned char* dst, int value) {
+        dst[0] = static_cast<unsigned char>(value & 0xFF);
+        dst[1] = static_cast<unsigned char>((value >> 8) & 0xFF);
+        dst[2] = static_cast<unsigned char>((value >> 16) & 0xFF);
+        dst[3] = static_cast<unsigned char>((value >> 24) & 0xFF);
+    }
+
+    size_t frameBytes_;
+    size_t totalBytes_;
+    int framesWritten_ = 0;
+    bool valid_ = false;
+#ifndef _WIN32
+    int fd_ = -1;
+    unsigned char* map_ = nullptr;
+#else
+    std::ofstream file_;
+#endif
+};
+
+// Codec for the per-tile difference bytes (current minus previous frame,
+// mod 256). The blend keeps 99.5% of every advected value, so most diffs
+// are zero or within a few levels; three ops cover the three regimes:
+//   0x00 len        len zero diffs
+//   0x01 len nib..  len diffs in [-7, 7], one nibble each (value + 7)
+//   0x02 len raw..  len literal diff bytes
+// with len in 1..255. Greedy, single pass, no tables.
+static bool deltaNibble(unsigned char d) {
+    return d <= 7 || d >= 249;  // signed value in [-7, 7]
+}
+
+static void deltaPack(const unsigned char* src, size_t size, std::vector<unsigned char>& out) {
+    size_t i = 0;
+    while (i < size) {
+        size_t zeros = 0;
+        while (i + zeros < size && zeros < 255 && src[i + zeros] == 0) {
+            ++zeros;
+        }
+        if (zeros >= 4 || (zeros > 0 && i + zeros == size)) {
+            out.push_back(0x00);
+            out.push_back(static_cast<unsigned char>(zeros));
+            i += zeros;
+            continue;
+        }
+        size_t nibbles = 0;
+        while (i + nibbles < size && nibbles < 255 && deltaNibble(src[i + nibbles])) {
+            // A long-enough zero run inside a nibble block costs more than
+            // splitting the block, so stop in front of one.
+            size_t innerZeros = 0;
+            while (i + nibbles + innerZeros < size && innerZeros < 8 && src[i + nibbles + innerZeros] == 0) {
+                ++innerZeros;
+            }
+            if (innerZeros >= 8) {
+                break;
+            }
+            ++nibbles;
+        }
+        if (nibbles >= 2) {
+            out.push_back(0x01);
+            out.push_back(static_cast<unsigned char>(nibbles));
+            for (size_t k = 0; k < nibbles; k += 2) {
+                const unsigned lo = (src[i + k] + 7u) & 0x0F;
+                const unsigned hi = k + 1 < nibbles ? (src[i + k + 1] + 7u) & 0x0F : 0;
+                out.push_back(static_cast<unsigned char>(lo | (hi << 4)));
+            }
+            i += nibbles;
+            continue;
+        }
+        size_t literal = 0;
+        while (i + literal < size && literal < 255) {
+            if (deltaNibble(src[i + literal]) && literal + 3 < size && deltaNibble(src[i + literal + 1]) &&
+                deltaNibble(src[i + literal + 2]) && deltaNibble(src[i + literal + 3])) {
+                break;
+            }
+            ++literal;
+        }
+        literal = std::max<size_t>(literal, 1);
+        out.push_back(0x02);
+        out.push_back(static_cast<unsigned char>(literal));
+        out.insert(out.end(), src + i, src + i + literal);
+        i += literal;
+    }
+}
+
+// Returns false on a malformed stream (payload overruns `size`).
+static bool deltaUnpack(const unsigned char* src, size_t srcSize, unsigned char* dst, size_t size) {
+    size_t i = 0;
+    size_t o = 0;
+    while (i + 1 < srcSize && o < size) {
+        const unsigned char op = src[i];
+        const size_t len = src[i + 1];
+        i += 2;
+        if (len == 0 || o + len > size) {
+            return false;
+        }
+        if (op == 0x00) {
+            std::fill(dst + o, dst + o + len, 0);
+        } else if (op == 0x01) {
+            const size_t packed = (len + 1) / 2;
+            if (i + packed > srcSize) {
+                return false;
+            }
+            for (size_t k = 0; k < len; ++k) {
+                const unsigned char byte = src[i + k / 2];
+                const unsigned nib = (k % 2 == 0 ? byte : byte >> 4) & 0x0F;
+                dst[o + k] = static_cast<unsigned char>(nib - 7u);
+            }
+            i += packed;
+        } else if (op == 0x02) {
+            if (i + len > srcSize) {
+                return false;
+            }
+            std::copy(src + i, src + i + len, dst + o);
+            i += len;
+        } else {
+            return false;
+        }
+        o += len;
+    }
+    return i == srcSize && o == size;
+}
+
+// Delta-encoded frame stream (--output-format=delta). Consecutive packed
+// frames differ by at most a few levels almost everywhere, so each frame
+// stores only the 32x32 tiles whose bytes changed, as deltaPack'd
+// differences against the previous frame. Layout: a 24-byte header
+// "WFLOWDLT" {width, height, frameCount, fps}, then per frame a LE u32
+// changed-tile count followed by {u16 tileX, u16 tileY, u32 payloadBytes,
+// payload} records. decodeDeltaStream() expands it back to the raw format.
+class DeltaFrameWriter {
+public:
+    DeltaFrameWriter(const std::string& path, int width, int height, int fps)
+        : width_(width), height_(height), frameBytes_(static_cast<size_t>(width) * height * 3),
+          previous_(frameBytes_, 0), file_(path, std::ios::binary) {
+        if (!file_) {
+            return;
+        }
+        unsigned char header[kHeaderBytes] = {'W', 'F', 'L', 'O', 'W', 'D', 'L', 'T'};
+        putLe32(header + 8, width);
+        putLe32(header + 12, height);
+        putLe32(header + 16, 0);  // frame count, patched in finish()
+        putLe32(header + 20, fps);
+        file_.write(reinterpret_cast<const char*>(header), kHeaderBytes);
+        valid_ = static_cast<bool>(file_);
+    }
+
+    DeltaFrameWriter(const DeltaFrameWriter&) = delete;
+    DeltaFrameWriter& operator=(const DeltaFrameWriter&) = delete;
+
+    bool valid() const { return valid_; }
+    int framesWritten() const { return framesWritten_; }
+    size_t bytesWritten() const { return bytesWritten_; }
+
+    void writeFrame(const unsigned char* rgb) {
+        const int tilesX = (width_ + kTileSize - 1) / kTileSize;
+        const int tilesY = (height_ + kTileSize - 1) / kTileSize;
+        record_.clear();
+        int changed = 0;
+        for (int ty = 0; ty < tilesY; ++ty) {
+            for (int tx = 0; tx < tilesX; ++tx) {
+                const int x0 = tx * kTileSize;
+                const int y0 = ty * kTileSize;
+                const size_t rowBytes = static_cast<size_t>(std::min(kTileSize, width_ - x0)) * 3;
+                const int rows = std::min(kTileSize, height_ - y0);
+
+                diff_.clear();
+                bool tileChanged = false;
+                for (int row = 0; row < rows; ++row) {
+                    const size_t offset = (static_cast<size_t>(y0 + row) * width_ + x0) * 3;
+                    for (size_t b = 0; b < rowBytes; ++b) {
+                        const unsigned char d = static_cast<unsigned char>(rgb[offset + b] - previous_[offset + b]);
+                        diff_.push_back(d);
+                        tileChanged = tileChanged || d != 0;
+                    }
+                }
+                if (!tileChanged) {
+                    continue;
+                }
+                ++changed;
+                payload_.clear();
+                deltaPack(diff_.data(), diff_.size(), payload_);
+                unsigned char tileHeader[8];
+                putLe16(tileHeader + 0, tx);
+                putLe16(tileHeader + 2, ty);
+                putLe32(tileHeader + 4, static_cast<int>(payload_.size()));
+                record_.insert(record_.end(), tileHeader, tileHeader + sizeof(tileHeader));
+                record_.insert(record_.end(), payload_.begin(), payload_.end());
+            }
+        }
+        unsigned char count[4];
+        putLe32(count, changed);
+        file_.write(reinterpret_cast<const char*>(count), sizeof(count));
+        file_.write(reinterpret_cast<const char*>(record_.data()), static_cast<std::streamsize>(record_.size()));
+        valid_ = static_cast<bool>(file_);
+        bytesWritten_ += sizeof(count) + record_.size();
+        std::copy(rgb, rgb + frameBytes_, previous_.begin());
+        ++framesWritten_;
+    }
+
+    void finish() {
+        unsigned char count[4];
+        putLe32(count, framesWritten_);
+        file_.seekp(16);
+        file_.write(reinterpret_cast<const char*>(count), 4);
+        file_.flush();
+        valid_ = static_cast<bool>(file_);
+    }
+
+    static constexpr int kTileSize = 32;
+    static constexpr size_t kHeaderBytes = 24;
+
+    static void putLe16(unsigned char* dst, int value) {
+        dst[0] = static_cast<unsigned char>(value & 0xFF);
+        dst[1] = static_cast<unsigned char>((value >> 8) & 0xFF);
+    }
+
+    static void putLe32(unsigned char* dst, int value) {
+        dst[0] = static_cast<unsigned char>(value & 0xFF);
+        dst[1] = static_cast<unsigned char>((value >> 8) & 0xFF);
+        dst[2] = static_cast<unsigned char>((value >> 16) & 0xFF);
+        dst[3] = static_cast<unsigned char>((value >> 24) & 0xFF);
+    }
+
+private:
+    int width_;
+    int height_;
+    size_t frameBytes_;
+    std::vector<unsigned char> previous_;
+    std::vector<unsigned char> diff_;
+    std::vector<unsigned char> payload_;
+    std::vector<unsigned char> record_;
+    std::ofstream file_;
+    int framesWritten_ = 0;
+    size_t bytesWritten_ = 0;
+    bool valid_ = false;
+};
+
+// --decode-delta=file: expands a DeltaFrameWriter stream back into the raw
+// frame format (same header and layout RawFrameWriter produces) next to the
+// input, so downstream tooling only ever has to read one format.
+static int decodeDeltaStream(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        std::cerr << "Failed to open '" << path << "'.\n";
+        return 1;
+    }
+    const auto getLe32 = [](const unsigned char* src) {
+        return static_cast<int>(src[0]) | (static_cast<int>(src[1]) << 8) | (static_cast<int>(src[2]) << 16) |
+               (static_cast<int>(src[3]) << 24);
+    };
+    const auto getLe16 = [](const unsigned char* src) {
+        return static_cast<int>(src[0]) | (static_cast<int>(src[1]) << 8);
+    };
+
+    unsigned char header[DeltaFrameWriter::kHeaderBytes];
+    in.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!in || std::memcmp(header, "WFLOWDLT", 8) != 0) {
+        std::cerr << "'" << path << "' is not a delta frame stream.\n";
+        return 1;
+    }
+    const int width = getLe32(header + 8);
+    const int height = getLe32(header + 12);
+    const int frameCount = getLe32(header + 16);
+    const int fps = getLe32(header + 20);
+    if (width <= 0 || height <= 0 || frameCount < 0) {
+        std::cerr << "'" << path << "' has a corrupt header.\n";
+        return 1;
+    }
+
+    const std::string outPath = std::filesystem::path(path).replace_extension(".raw").string();
+    RawFrameWriter out(outPath, width, height, frameCount, fps);
+    if (!out.valid()) {
+        std::cerr << "Failed to open " << outPath << " for decoded output.\n";
+        return 1;
+    }
+
+    constexpr int kTileSize = DeltaFrameWriter::kTileSize;
+    std::vector<unsigned char> frame(static_cast<size_t>(width) * height * 3, 0);
+    std::vector<unsigned char> payload;
+    std::vector<unsigned char> diff;
+    for (int f = 0; f < frameCount; ++f) {
+        unsigned char count[4];
+        in.read(reinterpret_cast<char*>(count), sizeof(count));
+        const int changed = in ? getLe32(count) : -1;
+        if (changed < 0) {
+            std::cerr << "'" << path << "' is truncated at frame " << f << ".\n";
+            return 1;
+        }
+        for (int t = 0; t < changed; ++t) {
+            unsigned char tileHeader[8];
+            in.read(reinterpret_cast<char*>(tileHeader), sizeof(tileHeader));
+            const int tx = getLe16(tileHeader + 0);
+            const int ty = getLe16(tileHeader + 2);
+            const int payloadBytes = getLe32(tileHeader + 4);
+            const int x0 = tx * kTileSize;
+            const int y0 = ty * kTileSize;
+            if (!in || x0 >= width || y0 >= height || payloadBytes < 0) {
+                std::cerr << "'" << path << "' has a corrupt tile record in frame " << f << ".\n";
+                return 1;
+            }
+            payload.resize(static_cast<size_t>(payloadBytes));
+            in.read(reinterpret_cast<char*>(payload.data()), payloadBytes);
+            const size_t rowBytes = static_cast<size_t>(std::min(kTileSize, width - x0)) * 3;
+            const int rows = std::min(kTileSize, height - y0);
+            diff.resize(rowBytes * rows);
+            if (!in || !deltaUnpack(payload.data(), payload.size(), diff.data(), diff.size())) {
+                std::cerr << "'" << path << "' has a corrupt tile payload in frame " << f << ".\n";
+                return 1;
+            }
+            for (int row = 0; row < rows; ++row) {
+                const size_t offset = (static_cast<size_t>(y0 + row) * width + x0) * 3;
+                for (size_t b = 0; b < rowBytes; ++b) {
+                    frame[offset + b] = static_cast<unsigned char>(frame[offset + b] + diff[row * rowBytes + b]);
+                }
+            }
+        }
+        out.writeFrame(frame.data());
+    }
+    out.finish();
+    if (!out.valid()) {
+        std::cerr << "Failed to finalize " << outPath << "\n";
+        return 1;
+    }
+    std::cout << "Decoded " << frameCount << " frames (" << width << "x" << height << ") to " << outPath << "\n";
+    return 0;
+}
+
+// --merge=seg1,seg2,...: concatenates the segments rendered by --frames
+// shards, in command-line order, into --output-dir/--gif-name (with the
+// segments' extension). Raw segments are checked for matching geometry and
+// their frames copied back to back under one patched header. GIF segments
+// are spliced at the block level: the first segment keeps its header, global
+// palette and loop extension, and every later frame carries its own
+// segment's palette as a local color table, since each streaming shard
+// derives its palette from its own first frame. Delta segments diff against
+// the previous frame across the shard boundary, so they must be decoded to
+// raw first.
+static int mergeSegments(const Config& cfg) {
+    const std::string ext = std::filesystem::path(cfg.mergePaths.front()).extension().string();
+    for (const std::string& path : cfg.mergePaths) {
+        if (std::filesystem::path(path).extension() != ext) {
+            std::cerr << "Cannot merge '" << path << "': every segment must be a " << ext << " file.\n";
+            return 1;
+        }
+    }
+    if (ext == ".wfd") {
+        std::cerr << "Delta segments cannot be concatenated: the first frame of each shard diffs against"
+                  << " the previous shard's last. Run --decode-delta on each and merge the .raw files.\n";
+        return 1;
+    }
+    if (ext != ".raw" && ext != ".gif") {
+        std::cerr << "Cannot merge '" << ext << "' segments. Expected .raw or .gif.\n";
+        return 1;
+    }
+    if (!cfg.outputDir.empty()) {
+        std::filesystem::create_directories(cfg.outputDir);
+    }
+    const std::string outPath = (cfg.outputDir / std::filesystem::path(cfg.gifName).replace_extension(ext)).string();
+    const auto getLe32 = [](const unsigned char* src) {
+        return static_cast<int>(src[0]) | (static_cast<int>(src[1]) << 8) | (static_cast<int>(src[2]) << 16) |
+               (static_cast<int>(src[3]) << 24);
+    };
+
+    if (ext == ".raw") {
+        struct Segment {
+            std::ifstream file;
+            int frames = 0;
+        };
+        std::vector<Segment> segments;
+        int width = 0;
+        int height = 0;
+        int fps = 0;
+        int totalFrames = 0;
+        for (const std::string& path : cfg.mergePaths) {
+            std::ifstream in(path, std::ios::binary);
+            unsigned char header[24];
+            in.read(reinterpret_cast<char*>(header), sizeof(header));
+            if (!in || std::memcmp(header, "WFLOWRAW", 8) != 0) {
+                std::cerr << "'" << path << "' is not a raw frame dump.\n";
+                return 1;
+            }
+            const int w = getLe32(header + 8);
+            const int h = getLe32(header + 12);
+            const int count = getLe32(header + 16);
+            const int f = getLe32(header + 20);
+            if (segments.empty()) {
+                width = w;
+                height = h;
+                fps = f;
+            } else if (w != width || h != height || f != fps) {
+                std::cerr << "'" << path << "' is " << w << "x" << h << "@" << f << " fps; the first segment is "
+                          << width << "x" << height << "@" << fps << ".\n";
+                return 1;
+            }
+            totalFrames += count;
+            segments.push_back({std::move(in), count});
+        }
+        RawFrameWriter out(outPath, width, height, totalFrames, fps);
+        if (!out.valid()) {
+            std::cerr << "Failed to open " << outPath << " for merged output.\n";
+            return 1;
+        }
+        std::vector<unsigned char> frame(static_cast<size_t>(width) * height * 3);
+        for (size_t s = 0; s < segments.size(); ++s) {
+            for (int f = 0; f < segments[s].frames; ++f) {
+                segments[s].file.read(reinterpret_cast<char*>(frame.data()), static_cast<std::streamsize>(frame.size()));
+                if (!segments[s].file) {
+                    std::cerr << "'" << cfg.mergePaths[s] << "' is truncated at frame " << f << ".\n";
+                    return 1;
+                }
+                out.writeFrame(frame.data());
+            }
+        }
+        out.finish();
+        if (!out.valid()) {
+            std::cerr << "Failed to finalize " << outPath << "\n";
+            return 1;
+        }
+        std::cout << "Merged " << totalFrames << " frames from " << segments.size() << " segments into " << outPath << "\n";
+        return 0;
+    }
+
+    std::ofstream out(outPath, std::ios::binary);
+    if (!out) {
+        std::cerr << "Failed to open " << outPath << " for merged output.\n";
+        return 1;
+    }
+    int width = 0;
+    int height = 0;
+    int totalFrames = 0;
+    for (size_t s = 0; s < cfg.mergePaths.size(); ++s) {
+        const std::string& path = cfg.mergePaths[s];
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in) {
+            std::cerr << "Failed to open '" << path << "'.\n";
+            return 1;
+        }
+        std::vector<unsigned char> data(static_cast<size_t>(in.tellg()));
+        in.seekg(0);
+        in.read(reinterpret_cast<char*>(data.data()), static_cast<std::streamsize>(data.size()));
+        if (!in || data.size() < 13 || std::memcmp(data.data(), "GIF", 3) != 0) {
+            std::cerr << "'" << path << "' is not a GIF.\n";
+            return 1;
+        }
+        const int w = data[6] | (data[7] << 8);
+        const int h = data[8] | (data[9] << 8);
+        if (s == 0) {
+            width = w;
+            height = h;
+        } else if (w != width || h != height) {
+            std::cerr << "'" << path << "' is " << w << "x" << h << "; the first segment is "
+                      << width << "x" << height << ".\n";
+            return 1;
+        }
+        const bool hasGlobalTable = (data[10] & 0x80) != 0;
+        const int tableBits = data[10] & 0x07;
+        const size_t tableBytes = hasGlobalTable ? 3u * (2u << tableBits) : 0u;
+        size_t pos = 13 + tableBytes;
+        if (pos > data.size()) {
+            std::cerr << "'" << path << "' is truncated.\n";
+            return 1;
+        }
+        if (s == 0) {
+            // Header, screen descriptor and global palette come from the
+            // first segment; every other palette rides along as local tables.
+            out.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(pos));
+        }
+        std::vector<unsigned char> pending;  // graphic control extension for the next image
+        while (pos < data.size() && data[pos] != 0x3B) {
+            if (data[pos] == 0x21) {
+                size_t end = pos + 2;
+                while (end < data.size() && data[end] != 0) {
+                    end += data[end] + 1;
+                }
+                end += 1;
+                if (end > data.size()) {
+                    std::cerr << "'" << path << "' has a truncated extension block.\n";
+                    return 1;
+                }
+                if (data[pos + 1] == 0xF9) {
+                    pending.assign(data.begin() + pos, data.begin() + end);
+                } else if (s == 0) {
+                    // Loop/application/comment extensions only once, up front.
+                    out.write(reinterpret_cast<const char*>(data.data() + pos), static_cast<std::streamsize>(end - pos));
+                }
+                pos = end;
+                continue;
+            }
+            if (data[pos] != 0x2C || pos + 11 > data.size()) {
+                std::cerr << "'" << path << "' has an unexpected block at offset " << pos << ".\n";
+                return 1;
+            }
+            unsigned char descriptor[10];
+            std::copy(data.begin() + pos, data.begin() + pos + 10, descriptor);
+            const bool hasLocalTable = (descriptor[9] & 0x80) != 0;
+            const size_t localBytes = hasLocalTable ? 3u * (2u << (descriptor[9] & 0x07)) : 0u;
+            size_t end = pos + 10 + localBytes + 1;  // descriptor, local table, min LZW code size
+            while (end < data.size() && data[end] != 0) {
+                end += data[end] + 1;
+            }
+            end += 1;
+            if (end > data.size()) {
+                std::cerr << "'" << path << "' has a truncated image block.\n";
+                return 1;
+            }
+            out.write(reinterpret_cast<const char*>(pending.data()), static_cast<std::streamsize>(pending.size()));
+            pending.clear();
+            if (s == 0 || hasLocalTable || !hasGlobalTable) {
+                out.write(reinterpret_cast<const char*>(data.data() + pos), static_cast<std::streamsize>(end - pos));
+            } else {
+                // Promote this segment's global palette to a local color
+                // table so the frame is not read through segment 0's palette.
+                descriptor[9] = static_cast<unsigned char>(descriptor[9] | 0x80 | tableBits);
+                out.write(reinterpret_cast<const char*>(descriptor), sizeof(descriptor));
+                out.write(reinterpret_cast<const char*>(data.data() + 13), static_cast<std::streamsize>(tableBytes));
+                out.write(reinterpret_cast<const char*>(data.data() + pos + 10),
+                          static_cast<std::streamsize>(end - (pos + 10)));
+            }
+            ++totalFrames;
+            pos = end;
+        }
+    }
+    const char trailer = 0x3B;
+    out.write(&trailer, 1);
+    out.flush();
+    if (!out) {
+        std::cerr << "Failed to finalize " << outPath << "\n";
+        return 1;
+    }
+    std::cout << "Merged " << totalFrames << " frames from " << cfg.mergePaths.size() << " segments into " << outPath << "\n";
+    return 0;
+}
+
+// Memory-mapped store of blurred velocity fields (--velocity-cache=path).
+// Slot k holds the finished fp32 field for step-time index k, with a per-slot
+// presence byte so a --velocity-update-every run only fills its keyframes and
+// a later run with a different stride reuses what exists and computes the
+// rest. The header records every Config field the cached data depends on;
+// dt and the vorticity eps are deliberately absent (dt only affects
+// advection, and confinement runs after the cache exchange), so dt and
+// vorticity sweeps share one cache. On POSIX the file is mmap'd and
+// load/store are plain memcpys; elsewhere it falls back to positioned
+// stream I/O like RawFrameWriter.
+class VelocityCache {
+public:
+    VelocityCache(const std::string& path, const Config& cfg)
+        : fieldBytes_(static_cast<size_t>(cfg.resolution) * cfg.resolution * 2 * sizeof(float)) {
+        Header expected = {};
+        std::copy(kMagic, kMagic + 8, expected.magic);
+        expected.version = 1;
+        expected.resolution = cfg.resolution;
+        expected.steps = cfg.steps;
+        expected.slots = cfg.steps + 1;
+        expected.strength = cfg.strength;
+        expected.blurSigma = cfg.blurSigma;
+        expected.boxBlur = cfg.boxBlur ? 1 : 0;
+        expected.wrapBoundary = cfg.wrapBoundary ? 1 : 0;
+        expected.fastMath = cfg.fastMath ? 1 : 0;
+        expected.velocityScale = cfg.velocityScale;
+
+        const bool existed = std::filesystem::exists(path) && std::filesystem::file_size(path) > 0;
+#ifndef _WIN32
+        fd_ = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd_ < 0) {
+            std::cerr << "Failed to open velocity cache '" << path << "'.\n";
+            return;
+        }
+#else
+        if (!existed) {
+            std::ofstream(path, std::ios::binary);  // create so in|out open succeeds
+        }
+        file_.open(path, std::ios::in | std::ios::out | std::ios::binary);
+        if (!file_) {
+            std::cerr << "Failed to open velocity cache '" << path << "'.\n";
+            return;
+        }
+#endif
+        if (existed) {
+            Header onDisk = {};
+            // The map does not exist yet, so the header check goes through
+            // plain positioned reads.
+#ifndef _WIN32
+            if (::pread(fd_, &onDisk, sizeof(onDisk), 0) != static_cast<ssize_t>(sizeof(onDisk))) {
+                std::cerr << "Failed to read velocity cache header from '" << path << "'.\n";
+                return;
+            }
+#else
+            readBytes(0, &onDisk, sizeof(onDisk));
+#endif
+            if (!std::equal(onDisk.magic, onDisk.magic + 8, kMagic) || onDisk.version != 1) {
+                std::cerr << "'" << path << "' is not a velocity cache.\n";
+                return;
+            }
+            if (onDisk.resolution != expected.resolution || onDisk.steps != expected.steps ||
+                onDisk.strength != expected.strength || onDisk.blurSigma != expected.blurSigma ||
+                onDisk.boxBlur != expected.boxBlur || onDisk.wrapBoundary != expected.wrapBoundary ||
+                onDisk.fastMath != expected.fastMath || onDisk.velocityScale != expected.velocityScale) {
+                std::cerr << "Velocity cache '" << path << "' was built for a different configuration "
+                          << "(resolution=" << onDisk.resolution << ", steps=" << onDisk.steps
+                          << ", strength=" << onDisk.strength << "). Delete it or point "
+                          << "--velocity-cache elsewhere.\n";
+                return;
+            }
+            slots_ = onDisk.slots;
+        } else {
+            slots_ = expected.slots;
+        }
+        totalBytes_ = sizeof(Header) + static_cast<size_t>(slots_) +
+                      fieldBytes_ * static_cast<size_t>(slots_);
+#ifndef _WIN32
+        if (::ftruncate(fd_, static_cast<off_t>(totalBytes_)) != 0) {
+            std::cerr << "Failed to size velocity cache '" << path << "'.\n";
+            return;
+        }
+        void* map = ::mmap(nullptr, totalBytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (map == MAP_FAILED) {
+            std::cerr << "Failed to map velocity cache '" << path << "'.\n";
+            return;
+        }
+        map_ = static_cast<unsigned char*>(map);
+#endif
+        if (!existed) {
+            writeBytes(0, &expected, sizeof(expected));
+            const std::vector<unsigned char> zeros(slots_, 0);
+            writeBytes(sizeof(Header), zeros.data(), zeros.size());
+        }
+        valid_ = true;
+    }
+
+    VelocityCache(const VelocityCache&) = delete;
+    VelocityCache& operator=(const VelocityCache&) = delete;
+
+    ~VelocityCache() {
+#ifndef _WIN32
+        if (map_ != nullptr) {
+            ::msync(map_, totalBytes_, MS_ASYNC);
+            ::munmap(map_, totalBytes_);
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+#endif
+    }
+
+    bool valid() const { return valid_; }
+
+    bool has(int slot) const {
+        if (slot < 0 || slot >= slots_) {
+            return false;
+        }
+        unsigned char flag = 0;
+        readBytes(sizeof(Header) + static_cast<size_t>(slot), &flag, 1);
+        return flag != 0;
+    }
+
+    void load(int slot, float* dst) const {
+        readBytes(fieldOffset(slot), dst, fieldBytes_);
+    }
+
+    void store(int slot, const float* src) {
+        if (slot < 0 || slot >= slots_) {
+            return;  // extrapolated keyframe past the last step; not worth a resize
+        }
+        writeBytes(fieldOffset(slot), src, fieldBytes_);
+        const unsigned char one = 1;
+        writeBytes(sizeof(Header) + static_cast<size_t>(slot), &one, 1);
+    }
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        int32_t resolution;
+        int32_t steps;
+        int32_t slots;
+        float strength;
+        float blurSigma;
+        uint32_t boxBlur;
+        uint32_t wrapBoundary;
+        uint32_t fastMath;
+        int32_t velocityScale;
+    };
+    static constexpr char kMagic[9] = "WFLOWVEL";
+
+    size_t fieldOffset(int slot) const {
+        return sizeof(Header) + static_cast<size_t>(slots_) + fieldBytes_ * static_cast<size_t>(slot);
+    }
+
+    void readBytes(size_t offset, void* dst, size_t count) const {
+#ifndef _WIN32
+        std::memcpy(dst, map_ + offset, count);
+#else
+        file_.seekg(static_cast<std::streamoff>(offset));
+        file_.read(static_cast<char*>(dst), static_cast<std::streamsize>(count));
+#endif
+    }
+
+    void writeBytes(size_t offset, const void* src, size_t count) {
+#ifndef _WIN32
+        std::memcpy(map_ + offset, src, count);
+#else
+        file_.seekp(static_cast<std::streamoff>(offset));
+        file_.write(static_cast<const char*>(src), static_cast<std::streamsize>(count));
+#endif
+    }
+
+    size_t fieldBytes_;
+    size_t totalBytes_ = 0;
+    int slots_ = 0;
+    bool valid_ = false;
+#ifndef _WIN32
+    int fd_ = -1;
+    unsigned char* map_ = nullptr;
+#else
+    mutable std::fstream file_;
+#endif
+};
+
+// Structured tracing surface (--trace=out.json): scoped zones around the
+// per-step stages are buffered in memory and written as Chrome trace-event
+// JSON (load in chrome://tracing or Perfetto) when the run finishes. On
+// Linux the writer also opens process-wide perf_event counters (cycles,
+// instructions, cache misses) and attaches the per-zone deltas as event
+// args; the counters are inherited by threads spawned after construction,
+// so the writer must be created before the pool. When perf_event is
+// unavailable (permissions, non-Linux) the zones carry timings only. A
+// null writer pointer disables everything at the cost of one branch.
+class TraceWriter {
+public:
+    struct Counters {
+        uint64_t cycles = 0;
+        uint64_t instructions = 0;
+        uint64_t cacheMisses = 0;
+    };
+
+    explicit TraceWriter(const std::string& path) : path_(path), start_(std::chrono::steady_clock::now()) {
+        events_.reserve(4096);
+#ifdef __linux__
+        cyclesFd_ = openCounter(PERF_COUNT_HW_CPU_CYCLES);
+        instructionsFd_ = openCounter(PERF_COUNT_HW_INSTRUCTIONS);
+        cacheMissesFd_ = openCounter(PERF_COUNT_HW_CACHE_MISSES);
+        countersAvailable_ = cyclesFd_ >= 0 && instructionsFd_ >= 0 && cacheMissesFd_ >= 0;
+        if (!countersAvailable_) {
+            closeCounters();
+            std::cerr << "perf_event counters unavailable; trace will carry timings only.\n";
+        }
+#endif
+    }
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter& operator=(const TraceWriter&) = delete;
+
+    ~TraceWriter() {
+#ifdef __linux__
+        closeCounters();
+#endif
+    }
+
+    double microsSinceStart() const {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start_).count();
+    }
+
+    Counters readCounters() const {
+        Counters counters;
+#ifdef __linux__
+        if (countersAvailable_) {
+            readOne(cyclesFd_, counters.cycles);
+            readOne(instructionsFd_, counters.instructions);
+            readOne(cacheMissesFd_, counters.cacheMisses);
+        }
+#endif
+        return counters;
+    }
+
+    bool countersAvailable() const { return countersAvailable_; }
+
+    void record(const char* name, int tid, int frame, double tsUs, double durUs,
+                const Counters& begin, const Counters& end) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        events_.push_back({name, tid, frame, tsUs, durUs,
+                           end.cycles - begin.cycles,
+                           end.instructions - begin.instructions,
+                           end.cacheMisses - begin.cacheMisses});
+    }
+
+    // Writes the buffered events; returns false (and reports) on failure.
+    bool finish() {
+        std::ofstream file(path_);
+        if (!file) {
+            std::cerr << "Failed to open trace file '" << path_ << "'.\n";
+            return false;
+        }
+        file << "{\"traceEvents\":[\n";
+        for (size_t i = 0; i < events_.size(); ++i) {
+            const Event& e = events_[i];
+            file << "{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << e.tid
+                 << ",\"ts\":" << e.tsUs << ",\"dur\":" << e.durUs
+                 << ",\"args\":{\"frame\":" << e.frame;
+            if (countersAvailable_) {
+                file << ",\"cycles\":" << e.cycles
+                     << ",\"instructions\":" << e.instructions
+                     << ",\"cache_misses\":" << e.cacheMisses;
+            }
+            file << "}}" << (i + 1 < events_.size() ? ",\n" : "\n");
+        }
+        file << "]}\n";
+        file.flush();
+        if (!file) {
+            std::cerr << "Failed to write trace file '" << path_ << "'.\n";
+            return false;
+        }
+        return true;
+    }
+
+private:
+    struct Event {
+        const char* name;
+        int tid;
+        int frame;
+        double tsUs;
+        double durUs;
+        uint64_t cycles;
+        uint64_t instructions;
+        uint64_t cacheMisses;
+    };
+
+#ifdef __linux__
+    static int openCounter(uint64_t config) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1;  // count pool/encoder threads spawned after this
+        return static_cast<int>(::syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+    }
+
+    static void readOne(int fd, uint64_t& value) {
+        if (::read(fd, &value, sizeof(value)) != static_cast<ssize_t>(sizeof(value))) {
+            value = 0;
+        }
+    }
+
+    void closeCounters() {
+        for (int* fd : {&cyclesFd_, &instructionsFd_, &cacheMissesFd_}) {
+            if (*fd >= 0) {
+                ::close(*fd);
+                *fd = -1;
+            }
+        }
+    }
+
+    int cyclesFd_ = -1;
+    int instructionsFd_ = -1;
+    int cacheMissesFd_ = -1;
+#endif
+
+    std::string path_;
+    std::chrono::steady_clock::time_point start_;
+    bool countersAvailable_ = false;
+    std::mutex mutex_;
+    std::vector<Event> events_;
+};
+
+// RAII zone: records one complete ("X") trace event over its lifetime.
+// Constructing with a null writer is the disabled fast path.
+class TraceZone {
+public:
+    TraceZone(TraceWriter* writer, const char* name, int tid, int frame)
+        : writer_(writer), name_(name), tid_(tid), frame_(frame) {
+        if (writer_ != nullptr) {
+            startUs_ = writer_->microsSinceStart();
+            begin_ = writer_->readCounters();
+        }
+    }
+
+    TraceZone(const TraceZone&) = delete;
+    TraceZone& operator=(const TraceZone&) = delete;
+
+    ~TraceZone() {
+        if (writer_ != nullptr) {
+            writer_->record(name_, tid_, frame_, startUs_, writer_->microsSinceStart() - startUs_,
+                            begin_, writer_->readCounters());
+        }
+    }
+
+private:
+    TraceWriter* writer_;
+    const char* name_;
+    int tid_;
+    int frame_;
+    double startUs_ = 0.0;
+    TraceWriter::Counters begin_;
+};
+
+// Binary state snapshot: the flow-defining Config fields, the step counter,
+// and the raw dye planes. Everything else (baseDye, velocity) is rebuilt
+// deterministically, so this is all a resumed run needs.
+template <typename A>
+static bool writeCheckpoint(const std::string& path, const Config& cfg, int step, const std::vector<float, A>& dye) {
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::binary);
+        if (!file) {
+            return false;
+        }
+        file.write("WFLOWCKP", 8);
+        const uint32_t version = 1;
+        const uint32_t resolution = static_cast<uint32_t>(cfg.resolution);
+        const uint32_t steps = static_cast<uint32_t>(cfg.steps);
+        const uint32_t stepValue = static_cast<uint32_t>(step);
+        file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+        file.write(reinterpret_cast<const char*>(&resolution), sizeof(resolution));
+        file.write(reinterpret_cast<const char*>(&steps), sizeof(steps));
+        file.write(reinterpret_cast<const char*>(&cfg.dt), sizeof(cfg.dt));
+        file.write(reinterpret_cast<const char*>(&cfg.strength), sizeof(cfg.strength));
+        file.write(reinterpret_cast<const char*>(&stepValue), sizeof(stepValue));
+        file.write(reinterpret_cast<const char*>(dye.data()), static_cast<std::streamsize>(dye.size() * sizeof(float)));
+        if (!file) {
+            return false;
+        }
+    }
+    // Rename so a crash mid-write never clobbers the previous snapshot.
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, path, ec);
+    return !ec;
+}
+
+template <typename A>
+static bool readCheckpoint(const std::string& path, const Config& cfg, int& step, std::vector<float, A>& dye) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) {
+        std::cerr << "Failed to open checkpoint '" << path << "'.\n";
+        return false;
+    }
+    char magic[8];
+    uint32_t version = 0;
+    uint32_t resolution = 0;
+    uint32_t steps = 0;
+    float dt = 0.0f;
+    float strength = 0.0f;
+    uint32_t stepValue = 0;
+    file.read(magic, 8);
+    file.read(reinterpret_cast<char*>(&version), sizeof(version));
+    file.read(reinterpret_cast<char*>(&resolution), sizeof(resolution));
+    file.read(reinterpret_cast<char*>(&steps), sizeof(steps));
+    file.read(reinterpret_cast<char*>(&dt), sizeof(dt));
+    file.read(reinterpret_cast<char*>(&strength), sizeof(strength));
+    file.read(reinterpret_cast<char*>(&stepValue), sizeof(stepValue));
+    if (!file || std::string(magic, 8) != "WFLOWCKP" || version != 1) {
+        std::cerr << "'" << path << "' is not a valid checkpoint.\n";
+        return false;
+    }
+    if (static_cast<int>(resolution) != cfg.resolution || static_cast<int>(steps) != cfg.steps ||
+        dt != cfg.dt || strength != cfg.strength) {
+        std::cerr << "Checkpoint parameters (resolution=" << resolution << ", steps=" << steps
+                  << ", dt=" << dt << ", strength=" << strength
+                  << ") do not match the current configuration.\n";
+        return false;
+    }
+    file.read(reinterpret_cast<char*>(dye.data()), static_cast<std::streamsize>(dye.size() * sizeof(float)));
+    if (!file) {
+        std::cerr << "Checkpoint '" << path << "' is truncated.\n";
+        return false;
+    }
+    step = static_cast<int>(stepValue);
+    return true;
+}
+
+static void ensureOutputDir(const std::filesystem::path& dir) {
+    if (!dir.empty()) {
+        std::filesystem::create_directories(dir);
+    }
+}
+
+// Renders one configuration end to end: state setup, optional resume, the
+// sim/encoder pipeline, and the output epilogue. The storage type S is the
+// in-memory representation of the field buffers (float, or uint16_t halves
+// with --storage=fp16); all kernel arithmetic stays in fp32 registers.
+template <typename S>
+static int runSimulationTyped(const Config& cfg) {
+    const int n = cfg.resolution;
+    bool roiActive = cfg.roiW > 0 && cfg.roiH > 0;
+    if (roiActive) {
+        if (cfg.roiX < 0 || cfg.roiY < 0 || cfg.roiX + cfg.roiW > n || cfg.roiY + cfg.roiH > n) {
+            std::cerr << "ROI " << cfg.roiX << "," << cfg.roiY << "," << cfg.roiW << "," << cfg.roiH
+                      << " does not fit a " << n << "x" << n << " domain.\n";
+            return 1;
+        }
+        if (cfg.backend == "cuda") {
+            std::cerr << "--roi is ignored with --backend=cuda (the device kernel renders the full domain).\n";
+            roiActive = false;
+        }
+    }
+    const int frameW = roiActive ? cfg.roiW : n;
+    const int frameH = roiActive ? cfg.roiH : n;
+    // --frames shard bounds: steps in [emitBegin, emitEnd) produce output,
+    // steps before emitBegin only replay the dye state, steps at or past
+    // emitEnd never run. Every shard of a run must share the remaining flags
+    // (--steps included: it fixes the time base), or the segments will not
+    // line up when merged.
+    const int emitEnd = cfg.frameEnd < 0 ? cfg.steps : std::min(cfg.frameEnd, cfg.steps);
+    const int emitBegin = cfg.frameBegin;
+    if (emitBegin >= emitEnd) {
+        std::cerr << "Frame range " << emitBegin << ":" << cfg.frameEnd << " selects nothing from "
+                  << cfg.steps << " steps.\n";
+        return 1;
+    }
+    // The tracer opens its inherited perf counters before any worker thread
+    // exists; the pool exists before any field buffer is written so every
+    // persistent buffer is first-touched band by band by its owning worker.
+    std::unique_ptr<TraceWriter> tracer;
+    if (!cfg.tracePath.empty()) {
+        tracer = std::make_unique<TraceWriter>(cfg.tracePath);
+    }
+    ThreadPool pool(cfg.threads, cfg.pinThreads);
+    FieldVector<S> baseDye = createInitialDye<S>(cfg, pool);
+    FieldVector<S> dye(baseDye.size());
+    FieldVector<S> tempDye(baseDye.size());
+    FieldVector<S> velocity(static_cast<size_t>(n) * n * 2);
+    const size_t planeSize = static_cast<size_t>(n) * n;
+    pool.parallelFor(0, n, [&](int rowBegin, int rowEnd) {
+        for (int c = 0; c < 3; ++c) {
+            const size_t begin = c * planeSize + static_cast<size_t>(rowBegin) * n;
+            const size_t end = c * planeSize + static_cast<size_t>(rowEnd) * n;
+            std::copy(baseDye.begin() + begin, baseDye.begin() + end, dye.begin() + begin);
+        }
+    });
+
+    ensureOutputDir(cfg.outputDir);
+    const std::string gifPath = (cfg.outputDir / cfg.gifName).string();
+    const std::string checkpointPath = (cfg.outputDir / std::filesystem::path(cfg.gifName).replace_extension(".ckpt")).string();
+
+    int startStep = 0;
+    if (!cfg.resumePath.empty()) {
+        int savedStep = 0;
+        if constexpr (std::is_same_v<S, float>) {
+            if (!readCheckpoint(cfg.resumePath, cfg, savedStep, dye)) {
+                return 1;
+            }
+        } else {
+            // Checkpoints stay fp32 on disk so runs can switch --storage.
+            std::vector<float> dye32(dye.size());
+            if (!readCheckpoint(cfg.resumePath, cfg, savedStep, dye32)) {
+                return 1;
+            }
+            fieldFromFloat(dye32, dye);
+        }
+        startStep = savedStep + 1;
+        std::cout << "Resumed from step " << savedStep << " (" << cfg.resumePath << ")\n";
+    }
+
+#ifdef USE_CUDA
+    CudaSimContext* cudaCtx = nullptr;
+    if (cfg.backend == "cuda") {
+        if (!cudaBackendAvailable()) {
+            std::cerr << "No usable CUDA device found.\n";
+            return 1;
+        }
+        if constexpr (std::is_same_v<S, float>) {
+            cudaCtx = cudaSimCreate(n, cfg.strength, cfg.dt, cfg.blurSigma, dye.data());
+        } else {
+            cudaCtx = cudaSimCreate(n, cfg.strength, cfg.dt, cfg.blurSigma, fieldToFloat(dye).data());
+        }
+        if (cudaCtx == nullptr) {
+            return 1;
+        }
+    }
+#else
+    if (cfg.backend == "cuda") {
+        std::cerr << "This build has no CUDA backend. Configure with -DWATER_FLOW_USE_CUDA=ON.\n";
+        return 1;
+    }
+#endif
+
+    if (cfg.maccormack && cfg.backend == "cuda") {
+        std::cerr << "--advect=maccormack is ignored with --backend=cuda (the device kernel is semi-Lagrangian).\n";
+    }
+    if (cfg.maccormack && cfg.tileSkip) {
+        std::cerr << "--tile-skip is ignored with --advect=maccormack: the corrector touches every tile.\n";
+    }
+    if (!cfg.emitters.empty() && cfg.backend == "cuda") {
+        std::cerr << "--emitter is ignored with --backend=cuda (the dye field stays on the device).\n";
+    }
+    if (cfg.vorticity > 0.0f && cfg.backend == "cuda") {
+        std::cerr << "--vorticity is ignored with --backend=cuda (the device pipeline has no confinement stage).\n";
+    }
+    if (roiActive && cfg.maccormack) {
+        std::cerr << "--advect=maccormack is ignored with --roi (the preview path uses the semi-Lagrangian kernel).\n";
+    }
+    if (roiActive && cfg.tileSkip) {
+        std::cerr << "--tile-skip is ignored with --roi (the cone already limits the work).\n";
+    }
+    if (roiActive && cfg.checkpointEvery > 0) {
+        std::cerr << "Note: checkpoints taken with --roi hold stale dye outside the crop's dependency cone"
+                  << " and only resume correctly with the same --roi.\n";
+    }
+    if (emitBegin > startStep) {
+        std::cerr << "Note: steps " << startStep << ".." << emitBegin - 1 << " are replayed to rebuild the dye"
+                  << " state before frame " << emitBegin << "; resume from a checkpoint at step "
+                  << emitBegin - 1 << " to skip the replay.\n";
+    }
+
+    std::unique_ptr<VelocityCache> velocityCache;
+    if (!cfg.velocityCachePath.empty()) {
+        if (cfg.backend == "cuda") {
+            std::cerr << "--velocity-cache is ignored with --backend=cuda (velocity stays on the device).\n";
+        } else {
+            velocityCache = std::make_unique<VelocityCache>(cfg.velocityCachePath, cfg);
+            if (!velocityCache->valid()) {
+                return 1;
+            }
+        }
+    }
+
+    // Small ring of frame buffers connecting the sim thread to the encoder
+    // thread: the sim fills a free buffer while the encoder drains ready ones,
+    // so Magick++ conversion and GIF encoding overlap with the next step.
+    constexpr int kEncodeRingDepth = 3;
+    std::vector<std::vector<unsigned char>> encodeRing(
+        kEncodeRingDepth, std::vector<unsigned char>(static_cast<size_t>(frameW) * frameH * 3));
+    std::deque<int> freeBuffers;
+    std::deque<int> readyBuffers;
+    for (int i = 0; i < kEncodeRingDepth; ++i) {
+        freeBuffers.push_back(i);
+    }
+    std::mutex ringMutex;
+    std::condition_variable ringCv;
+    bool simDone = false;
+    std::atomic<bool> encodeFailed{false};
+    std::string encodeError;
+    double encodeSeconds = 0.0;  // only touched by the encoder thread, read after join
+
+    // The writers open (and fail) before any helper thread exists, so the
+    // early returns below never leave a joinable thread behind.
+    std::vector<Magick::Image> frames;
+    const size_t delayCs = std::max<size_t>(1, static_cast<size_t>(std::round(100.0 / std::max(1, cfg.fps))));
+
+    const bool rawOutput = cfg.outputFormat == "raw";
+    const bool deltaOutput = cfg.outputFormat == "delta";
+    const std::string rawPath = (cfg.outputDir / std::filesystem::path(cfg.gifName).replace_extension(".raw")).string();
+    const std::string deltaPath = (cfg.outputDir / std::filesystem::path(cfg.gifName).replace_extension(".wfd")).string();
+
+    std::unique_ptr<StreamingGifWriter> gifWriter;
+    std::unique_ptr<RawFrameWriter> rawWriter;
+    std::unique_ptr<DeltaFrameWriter> deltaWriter;
+    if (rawOutput) {
+        rawWriter = std::make_unique<RawFrameWriter>(rawPath, frameW, frameH, emitEnd - emitBegin, cfg.fps);
+        if (!rawWriter->valid()) {
+            std::cerr << "Failed to open " << rawPath << " for raw output.\n";
+            return 1;
+        }
+    } else if (deltaOutput) {
+        deltaWriter = std::make_unique<DeltaFrameWriter>(deltaPath, frameW, frameH, cfg.fps);
+        if (!deltaWriter->valid()) {
+            std::cerr << "Failed to open " << deltaPath << " for delta output.\n";
+            return 1;
+        }
+    } else if (cfg.streamOutput) {
+        gifWriter = std::make_unique<StreamingGifWriter>(gifPath, frameW, frameH, delayCs, cfg.threads);
+        if (!gifWriter->valid()) {
+            std::cerr << "Failed to open " << gifPath << " for streaming output.\n";
+            return 1;
+        }
+    } else {
+        frames.reserve(static_cast<size_t>(emitEnd - emitBegin));
+    }
+
+#ifdef USE_OPENCV
+    // Latest-frame mailbox feeding a dedicated display thread: the sim
+    // publishes RGB frames with a try_lock (dropping the frame when the
+    // display is busy) and never sleeps for the window. All HighGUI calls,
+    // the BGR conversion, and the fps throttle live on the display thread.
+    std::vector<unsigned char> mailbox(static_cast<size_t>(frameW) * frameH * 3);
+    uint64_t mailboxSeq = 0;  // guarded by mailboxMutex
+    bool displayDone = false;
+    std::mutex mailboxMutex;
+    std::condition_variable mailboxCv;
+    std::atomic<bool> stopRequested{false};
+    std::thread displayThread;
+    if (cfg.liveView) {
+        displayThread = std::thread([&] {
+            cv::namedWindow("Procedural Water Flow", cv::WINDOW_AUTOSIZE);
+            const int pauseMs = std::max(1, static_cast<int>(1000.0 / static_cast<double>(std::max(1, cfg.fps))));
+            std::vector<unsigned char> local(mailbox.size());
+            cv::Mat bgr(frameH, frameW, CV_8UC3);
+            uint64_t seen = 0;
+            for (;;) {
+                {
+                    std::unique_lock<std::mutex> lock(mailboxMutex);
+                    mailboxCv.wait(lock, [&] { return mailboxSeq != seen || displayDone; });
+                    if (mailboxSeq == seen) {
+                        break;
+                    }
+                    seen = mailboxSeq;
+                    local = mailbox;
+                }
+                cv::cvtColor(cv::Mat(frameH, frameW, CV_8UC3, local.data()), bgr, cv::COLOR_RGB2BGR);
+                cv::imshow("Procedural Water Flow", bgr);
+                if (cv::waitKey(pauseMs) == 27) {
+                    stopRequested = true;
+                }
+            }
+            cv::destroyWindow("Procedural Water Flow");
+        });
+    }
+#endif
+
+    std::thread encoder([&] {
+        int framesEncoded = 0;
+        for (;;) {
+            int idx = -1;
+            {
+                std::unique_lock<std::mutex> lock(ringMutex);
+                ringCv.wait(lock, [&] { return !readyBuffers.empty() || simDone; });
+                if (readyBuffers.empty()) {
+                    return;
+                }
+                idx = readyBuffers.front();
+                readyBuffers.pop_front();
+            }
+            const std::vector<unsigned char>& rgb = encodeRing[idx];
+            TraceZone traceZone(tracer.get(), "encode", 1, framesEncoded++);
+            const auto encodeStart = std::chrono::steady_clock::now();
+            if (rawOutput) {
+                rawWriter->writeFrame(rgb.data());
+                if (!rawWriter->valid() && !encodeFailed.exchange(true)) {
+                    std::lock_guard<std::mutex> lock(ringMutex);
+                    encodeError = "Failed to write raw frame to " + rawPath;
+                }
+            } else if (deltaOutput) {
+                deltaWriter->writeFrame(rgb.data());
+                if (!deltaWriter->valid() && !encodeFailed.exchange(true)) {
+                    std::lock_guard<std::mutex> lock(ringMutex);
+                    encodeError = "Failed to append delta frame to " + deltaPath;
+                }
+            } else if (cfg.streamOutput) {
+                gifWriter->writeFrame(rgb.data());
+                if (!gifWriter->valid() && !encodeFailed.exchange(true)) {
+                    std::lock_guard<std::mutex> lock(ringMutex);
+                    encodeError = "Failed to append frame to " + gifPath;
+                }
+            } else {
+                try {
+                    Magick::Image frame;
+                    frame.size(Magick::Geometry(frameW, frameH));
+                    frame.depth(8);
+                    frame.magick("RGB");
+                    frame.read(frameW, frameH, "RGB", Magick::CharPixel, rgb.data());
+                    frame.animationDelay(static_cast<size_t>(delayCs));
+                    frames.emplace_back(std::move(frame));
+                } catch (const Magick::Exception& err) {
+                    if (!encodeFailed.exchange(true)) {
+                        std::lock_guard<std::mutex> lock(ringMutex);
+                        encodeError = err.what();
+                    }
+                }
+            }
+            encodeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - encodeStart).count();
+            {
+                std::lock_guard<std::mutex> lock(ringMutex);
+                freeBuffers.push_back(idx);
+            }
+            ringCv.notify_all();
+        }
+    });
+
+    // With --velocity-update-every=K the full psi evaluation and blur only run
+    // on keyframe steps; intermediate steps interpolate between the bracketing
+    // keyframes. The velocity is linear in psi, so lerping the blurred fields
+    // equals blurring a lerped psi grid.
+    const int velocityStride = cfg.velocityUpdateEvery;
+    FieldVector<S> velocityKeyA;
+    FieldVector<S> velocityKeyB;
+    int currentKeyStep = -1;
+    const auto stepTime = [&](int step) {
+        return static_cast<float>(step) / static_cast<float>(cfg.steps) * 6.0f;
+    };
+    SimBuffers buffers(n);
+    TileActivity tileActivity(n, n);
+    FieldVector<S> mcForward;  // --advect=maccormack scratch: forward-advected field
+    FieldVector<S> mcBack;     // ...and its backward re-advection
+    // Replay steps before --frames still advect into a frame buffer (the
+    // pack is fused into the kernel) but never touch the encode ring.
+    std::vector<unsigned char> warmupRgb;
+    if (emitBegin > 0) {
+        warmupRgb.resize(static_cast<size_t>(frameW) * frameH * 3);
+    }
+    // Per-step backtrace reach in pixels for the --roi dependency cone. The
+    // stream function's gradient per normalized coordinate is at most
+    // 2*pi*(3 + 2*0.6 + 4*0.25), the curl difference spans two cells, and the
+    // curl scale is strength*n/2, so the speed bound is resolution-independent.
+    // Blur, keyframe lerp and upsampling are convex and preserve it; +1 covers
+    // the bilinear footprint.
+    constexpr float kPsiGradientBound = 2.0f * 3.14159265358979323846f * 5.2f;
+    // Confinement can add at most eps times the curl (itself at most four
+    // speed-bound differences) to each component, hence the (1 + 4*eps).
+    const float speedBound = kPsiGradientBound * cfg.strength * (1.0f + 4.0f * cfg.vorticity);
+    const int roiReach = static_cast<int>(std::ceil(cfg.dt * speedBound)) + 1;
+    const PixelRect roiRect{cfg.roiX, cfg.roiY, cfg.roiX + cfg.roiW, cfg.roiY + cfg.roiH};
+
+    // Sparse update list for --emitter: built once, then applied after every
+    // advection to just the covered pixels. The quadratic rim falloff feathers
+    // the deposit to zero so the sources do not leave hard discs.
+    struct EmitterSample {
+        int x;
+        int y;
+        float weight;  // rate * falloff
+        float color[3];
+    };
+    std::vector<EmitterSample> emitterSamples;
+    std::vector<int> emitterTiles;  // tiles --tile-skip must never park
+    for (const Emitter& e : cfg.emitters) {
+        const float color[3] = {static_cast<float>((e.color >> 16) & 0xFF),
+                                static_cast<float>((e.color >> 8) & 0xFF),
+                                static_cast<float>(e.color & 0xFF)};
+        for (int dy = -e.radius; dy <= e.radius; ++dy) {
+            for (int dx = -e.radius; dx <= e.radius; ++dx) {
+                const float d2 = static_cast<float>(dx * dx + dy * dy);
+                const float r2 = static_cast<float>(e.radius) * static_cast<float>(e.radius);
+                if (d2 > r2) {
+                    continue;
+                }
+                int px = e.x + dx;
+                int py = e.y + dy;
+                if (cfg.wrapBoundary) {
+                    px = WrapBoundary::index(px, n);
+                    py = WrapBoundary::index(py, n);
+                } else if (px < 0 || px >= n || py < 0 || py >= n) {
+                    continue;
+                }
+                EmitterSample sample{px, py, e.rate * (1.0f - d2 / r2), {color[0], color[1], color[2]}};
+                emitterSamples.push_back(sample);
+                if (cfg.tileSkip) {
+                    emitterTiles.push_back((py / TileActivity::kTileSize) * tileActivity.tilesX +
+                                           px / TileActivity::kTileSize);
+                }
+            }
+        }
+    }
+    std::sort(emitterTiles.begin(), emitterTiles.end());
+    emitterTiles.erase(std::unique(emitterTiles.begin(), emitterTiles.end()), emitterTiles.end());
+
+    // Blends the covered dye pixels toward their emitter colors and repacks
+    // just those pixels of the already-converted frame.
+    const auto applyEmitters = [&](FieldVector<S>& field, unsigned char* rgbOut) {
+        for (const EmitterSample& s : emitterSamples) {
+            const size_t idx = static_cast<size_t>(s.y) * n + s.x;
+            const bool inFrame = !roiActive || (s.x >= roiRect.x0 && s.x < roiRect.x1 &&
+                                                s.y >= roiRect.y0 && s.y < roiRect.y1);
+            const size_t frameIdx = roiActive && inFrame
+                                        ? static_cast<size_t>(s.y - roiRect.y0) * frameW + (s.x - roiRect.x0)
+                                        : idx;
+            for (int c = 0; c < 3; ++c) {
+                const float v = storageToFloat(field[c * planeSize + idx]);
+                const float mixed = v + s.weight * (s.color[c] - v);
+                field[c * planeSize + idx] = floatToStorage<S>(mixed);
+                if (inFrame) {
+                    rgbOut[3 * frameIdx + c] = static_cast<unsigned char>(std::clamp(mixed, 0.0f, 255.0f));
+                }
+            }
+        }
+    };
+    const int coarseN = std::max(2, n / cfg.velocityScale);
+    Config coarseCfg = cfg;
+    coarseCfg.resolution = coarseN;
+    FieldVector<S> coarseVelocity;
+    std::vector<float> cacheScratch;  // fp32 staging when --storage=fp16 meets the cache
+    // `velocityStep` is the step index whose stepTime the field is built for;
+    // it doubles as the cache slot, so a stride-K run and a stride-1 run
+    // agree on which slot holds which field.
+    const auto buildBlurredVelocity = [&](int velocityStep, FieldVector<S>& dst) {
+        if (velocityCache && velocityCache->has(velocityStep)) {
+            dst.resize(static_cast<size_t>(n) * n * 2);
+            if constexpr (std::is_same_v<S, float>) {
+                velocityCache->load(velocityStep, dst.data());
+            } else {
+                cacheScratch.resize(dst.size());
+                velocityCache->load(velocityStep, cacheScratch.data());
+                fieldFromFloat(cacheScratch, dst);
+            }
+            return;
+        }
+        const float t = stepTime(velocityStep);
+        if (cfg.velocityScale <= 1) {
+            buildVelocityField(cfg, t, dst, buffers, pool);
+            gaussianBlur(dst, n, n, 2, cfg.blurSigma, cfg.boxBlur, cfg.wrapBoundary, buffers, pool);
+        } else {
+            buildVelocityField(coarseCfg, t, coarseVelocity, buffers, pool);
+            gaussianBlur(coarseVelocity, coarseN, coarseN, 2, cfg.blurSigma, cfg.boxBlur, cfg.wrapBoundary, buffers, pool);
+            upsampleVelocity(coarseVelocity, coarseN, n, dst, pool);
+        }
+        if (velocityCache) {
+            if constexpr (std::is_same_v<S, float>) {
+                velocityCache->store(velocityStep, dst.data());
+            } else {
+                cacheScratch = fieldToFloat(dst);
+                velocityCache->store(velocityStep, cacheScratch.data());
+            }
+        }
+    };
+    // Confinement runs after the cache exchange: like dt, eps stays out of
+    // the cache key, so vorticity sweeps share one cached blurred field.
+    const auto buildConfinedVelocity = [&](int velocityStep, FieldVector<S>& dst) {
+        buildBlurredVelocity(velocityStep, dst);
+        if (cfg.vorticity > 0.0f) {
+            applyVorticityConfinement(cfg, dst, buffers, pool);
+        }
+    };
+
+    using Clock = std::chrono::steady_clock;
+    const auto secondsSince = [](Clock::time_point start) {
+        return std::chrono::duration<double>(Clock::now() - start).count();
+    };
+    double velocitySeconds = 0.0;
+    double advectSeconds = 0.0;
+    double encodeWaitSeconds = 0.0;
+    int framesRendered = 0;
+
+#ifdef USE_CUDA
+    const bool useCudaBackend = cudaCtx != nullptr;
+#else
+    constexpr bool useCudaBackend = false;
+#endif
+    double gpuSeconds = 0.0;
+    const auto acquireEncodeBuffer = [&] {
+        std::unique_lock<std::mutex> lock(ringMutex);
+        ringCv.wait(lock, [&] { return !freeBuffers.empty(); });
+        const int idx = freeBuffers.front();
+        freeBuffers.pop_front();
+        return idx;
+    };
+
+    for (int step = startStep; step < emitEnd && !encodeFailed; ++step) {
+        const bool emitFrame = step >= emitBegin;
+        auto stageStart = Clock::now();
+        int bufferIdx = -1;
+
+        if (useCudaBackend) {
+#ifdef USE_CUDA
+            if (emitFrame) {
+                TraceZone traceZone(tracer.get(), "encode-wait", 0, step);
+                bufferIdx = acquireEncodeBuffer();
+            }
+            encodeWaitSeconds += secondsSince(stageStart);
+            stageStart = Clock::now();
+            {
+                TraceZone traceZone(tracer.get(), "gpu-step", 0, step);
+                unsigned char* rgbOut = emitFrame ? encodeRing[bufferIdx].data() : warmupRgb.data();
+                if (!cudaSimStep(cudaCtx, stepTime(step), 0.995f, rgbOut)) {
+                    std::cerr << "CUDA simulation step " << step << " failed.\n";
+                    if (emitFrame) {
+                        std::lock_guard<std::mutex> lock(ringMutex);
+                        freeBuffers.push_back(bufferIdx);
+                    }
+                    break;
+                }
+            }
+            gpuSeconds += secondsSince(stageStart);
+#endif
+        } else {
+            {
+                TraceZone traceZone(tracer.get(), "velocity", 0, step);
+                if (velocityStride <= 1) {
+                    buildConfinedVelocity(step, velocity);
+                } else {
+                    const int keyStep = step / velocityStride * velocityStride;
+                    if (keyStep != currentKeyStep) {
+                        if (keyStep == currentKeyStep + velocityStride && !velocityKeyB.empty()) {
+                            velocityKeyA.swap(velocityKeyB);
+                        } else {
+                            // First step, or a resume landed mid-interval.
+                            buildConfinedVelocity(keyStep, velocityKeyA);
+                        }
+                        buildConfinedVelocity(keyStep + velocityStride, velocityKeyB);
+                        currentKeyStep = keyStep;
+                    }
+                    const float alpha = static_cast<float>(step - keyStep) / static_cast<float>(velocityStride);
+                    velocity.resize(velocityKeyA.size());
+                    pool.parallelFor(0, n, [&](int rowBegin, int rowEnd) {
+                        for (size_t i = static_cast<size_t>(rowBegin) * n * 2; i < static_cast<size_t>(rowEnd) * n * 2; ++i) {
+                            const float a = storageToFloat(velocityKeyA[i]);
+                            velocity[i] = floatToStorage<S>(a + alpha * (storageToFloat(velocityKeyB[i]) - a));
+                        }
+                    });
+                }
+            }
+            velocitySeconds += secondsSince(stageStart);
+
+            stageStart = Clock::now();
+            if (emitFrame) {
+                TraceZone traceZone(tracer.get(), "encode-wait", 0, step);
+                bufferIdx = acquireEncodeBuffer();
+            }
+            encodeWaitSeconds += secondsSince(stageStart);
+            std::vector<unsigned char>& rgbBuffer = emitFrame ? encodeRing[bufferIdx] : warmupRgb;
+
+            stageStart = Clock::now();
+            {
+                TraceZone traceZone(tracer.get(), "advect", 0, step);
+                if (roiActive) {
+                    // Cone for the dye this step produces: the ROI grown by one
+                    // backtrace reach per remaining emitted step, so the last
+                    // frame is still built entirely from valid data. Regions the
+                    // cone has left keep stale dye that no later step reads.
+                    const int margin = (emitEnd - 1 - step) * roiReach;
+                    PixelRect rect{roiRect.x0 - margin, roiRect.y0 - margin,
+                                   roiRect.x1 + margin, roiRect.y1 + margin};
+                    if (cfg.wrapBoundary && (rect.x0 < 0 || rect.x1 > n || rect.y0 < 0 || rect.y1 > n)) {
+                        // A cone spilling past a wrapped edge depends on the far side.
+                        rect = PixelRect{0, 0, n, n};
+                    } else {
+                        rect.x0 = std::max(rect.x0, 0);
+                        rect.y0 = std::max(rect.y0, 0);
+                        rect.x1 = std::min(rect.x1, n);
+                        rect.y1 = std::min(rect.y1, n);
+                    }
+                    advectBlendConvertRoi(dye, baseDye, velocity, n, n, cfg.dt, 0.995f, 0.005f, tempDye,
+                                          rgbBuffer.data(), pool, cfg.wrapBoundary, rect, roiRect);
+                } else if (cfg.maccormack) {
+                    advectField(dye, velocity, n, n, cfg.dt, mcForward, pool, cfg.wrapBoundary);
+                    advectField(mcForward, velocity, n, n, -cfg.dt, mcBack, pool, cfg.wrapBoundary);
+                    maccormackBlendConvert(dye, mcForward, mcBack, baseDye, velocity, n, n, cfg.dt, 0.995f,
+                                           0.005f, tempDye, rgbBuffer.data(), pool, cfg.wrapBoundary);
+                } else {
+                    // A parked tile would keep accumulating deposits without
+                    // ever advecting them, so emitter tiles never go quiet.
+                    for (const int tile : emitterTiles) {
+                        tileActivity.quiet[tile] = 0;
+                    }
+                    advectBlendConvert(dye, baseDye, velocity, n, n, cfg.dt, 0.995f, 0.005f, tempDye, rgbBuffer.data(), pool,
+                                       cfg.wrapBoundary, cfg.tileSkip ? &tileActivity : nullptr);
+                }
+                dye.swap(tempDye);
+                if (!emitterSamples.empty()) {
+                    applyEmitters(dye, rgbBuffer.data());
+                }
+            }
+            advectSeconds += secondsSince(stageStart);
+        }
+
+#ifdef USE_OPENCV
+        // Publish the RGB frame to the display mailbox before the encoder can
+        // recycle the ring buffer. try_lock drops the frame instead of making
+        // the sim wait on a busy display.
+        if (cfg.liveView && emitFrame) {
+            std::unique_lock<std::mutex> lock(mailboxMutex, std::try_to_lock);
+            if (lock.owns_lock()) {
+                mailbox = encodeRing[bufferIdx];
+                ++mailboxSeq;
+                lock.unlock();
+                mailboxCv.notify_one();
+            }
+        }
+#endif
+
+        if (cfg.checksum && emitFrame) {
+            std::cout << "Checksum step " << step << ": " << std::hex
+                      << fnv1a(encodeRing[bufferIdx].data(), encodeRing[bufferIdx].size()) << std::dec << "\n";
+        }
+
+        if (emitFrame) {
+            {
+                std::lock_guard<std::mutex> lock(ringMutex);
+                readyBuffers.push_back(bufferIdx);
+            }
+            ringCv.notify_all();
+            ++framesRendered;
+        }
+
+        if (cfg.checkpointEvery > 0 && (step + 1) % cfg.checkpointEvery == 0) {
+            if constexpr (std::is_same_v<S, float>) {
+#ifdef USE_CUDA
+                if (useCudaBackend && !cudaSimDownloadDye(cudaCtx, dye.data())) {
+                    std::cerr << "Failed to download dye state for checkpointing.\n";
+                }
+#endif
+                if (!writeCheckpoint(checkpointPath, cfg, step, dye)) {
+                    std::cerr << "Failed to write checkpoint to " << checkpointPath << "\n";
+                }
+            } else {
+                std::vector<float> dye32 = fieldToFloat(dye);
+#ifdef USE_CUDA
+                if (useCudaBackend && !cudaSimDownloadDye(cudaCtx, dye32.data())) {
+                    std::cerr << "Failed to download dye state for checkpointing.\n";
+                }
+#endif
+                if (!writeCheckpoint(checkpointPath, cfg, step, dye32)) {
+                    std::cerr << "Failed to write checkpoint to " << checkpointPath << "\n";
+                }
+            }
+        }
+
+#ifdef USE_OPENCV
+        if (stopRequested) {
+            std::cout << "Stopping simulation (ESC pressed).\n";
+            break;
+        }
+#endif
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(ringMutex);
+        simDone = true;
+    }
+    ringCv.notify_all();
+    encoder.join();
+
+#ifdef USE_OPENCV
+    if (cfg.liveView) {
+        {
+            std::lock_guard<std::mutex> lock(mailboxMutex);
+            displayDone = true;
+        }
+        mailboxCv.notify_all();
+        displayThread.join();
+    }
+#endif
+
+#ifdef USE_CUDA
+    if (cudaCtx != nullptr) {
+        cudaSimDestroy(cudaCtx);
+    }
+#endif
+
+    if (tracer != nullptr && tracer->finish()) {
+        std::cout << "Wrote trace to " << cfg.tracePath << "\n";
+    }
+
+    if (encodeFailed) {
+        std::cerr << "Failed to encode frames: " << encodeError << "\n";
+        return 1;
+    }
+
+    if (cfg.profile && framesRendered > 0) {
+        const double frames = static_cast<double>(framesRendered);
+        std::cout << "Per-stage timing over " << framesRendered << " frames (ms/frame):\n";
+        if (useCudaBackend) {
+            std::cout << "  gpu-step    " << gpuSeconds * 1e3 / frames << "\n";
+        }
+        std::cout << "  velocity    " << velocitySeconds * 1e3 / frames << "\n"
+                  << "  advect      " << advectSeconds * 1e3 / frames << " (fused blend+convert)\n"
+                  << "  encode-wait " << encodeWaitSeconds * 1e3 / frames << "\n"
+                  << "  encode      " << encodeSeconds * 1e3 / frames << " (overlapped on encoder thread)\n";
+        if (cfg.tileSkip && tileActivity.totalTiles > 0) {
+            std::cout << "  tiles skipped " << tileActivity.skippedTiles << " / " << tileActivity.totalTiles
+                      << " (" << 100.0 * static_cast<double>(tileActivity.skippedTiles) /
+                                     static_cast<double>(tileActivity.totalTiles)
+                      << "%)\n";
+        }
+    }
+
+    if (rawOutput) {
+        rawWriter->finish();
+        if (!rawWriter->valid()) {
+            std::cerr << "Failed to finalize " << rawPath << "\n";
+            return 1;
+        }
+        std::cout << "Saved " << rawWriter->framesWritten() << " raw frames to " << rawPath << "\n";
+    } else if (deltaOutput) {
+        deltaWriter->finish();
+        if (!deltaWriter->valid()) {
+            std::cerr << "Failed to finalize " << deltaPath << "\n";
+            return 1;
+        }
+        const size_t fullBytes = static_cast<size_t>(frameW) * frameH * 3 *
+                                 static_cast<size_t>(deltaWriter->framesWritten());
+        std::cout << "Saved " << deltaWriter->framesWritten() << " delta frames to " << deltaPath << " ("
+                  << deltaWriter->bytesWritten() << " bytes, " << fullBytes << " raw)\n";
+    } else if (cfg.streamOutput) {
+        gifWriter->finish();
+        if (!gifWriter->valid()) {
+            std::cerr << "Failed to finalize " << gifPath << "\n";
+            return 1;
+        }
+        std::cout << "Saved animation to " << gifPath << "\n";
+    } else {
+        try {
+            Magick::writeImages(frames.begin(), frames.end(), gifPath);
+            std::cout << "Saved animation to " << gifPath << "\n";
+        } catch (const Magick::Exception& err) {
+            std::cerr << "Failed to write GIF: " << err.what() << "\n";
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static int runSimulation(const Config& cfg) {
+    return cfg.fp16Storage ? runSimulationTyped<uint16_t>(cfg) : runSimulationTyped<float>(cfg);
+}
+
+// Renders every variant listed in --sweep=file within this process. Each
+// non-empty, non-# line is a whitespace-separated list of --key=value
+// overrides applied on top of the base command line. A few variants run
+// concurrently with the worker budget split between them, so one variant's
+// serial phases (encode, I/O) overlap another's compute, and process
+// startup, Magick initialization, and dye setup are paid once per process
+// instead of once per variant.
+static int runSweep(const Config& base) {
+    std::ifstream file(base.sweepPath);
+    if (!file) {
+        std::cerr << "Failed to open sweep file '" << base.sweepPath << "'.\n";
+        return 1;
+    }
+
+    std::vector<Config> variants;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::vector<std::string> overrides;
+        std::string token;
+        std::istringstream tokens(line);
+        while (tokens >> token) {
+            overrides.push_back(token);
+        }
+        if (overrides.empty() || overrides.front()[0] == '#') {
+            continue;
+        }
+        Config cfg = applyOverrides(base, overrides);
+        cfg.sweepPath.clear();
+        cfg.liveView = false;
+        if (cfg.gifName == base.gifName && cfg.outputDir == base.outputDir) {
+            // The line did not pick its own output; suffix the variant index
+            // so concurrent renders cannot clobber each other.
+            const std::filesystem::path name(cfg.gifName);
+            cfg.gifName = name.stem().string() + "_" + std::to_string(variants.size() + 1) + name.extension().string();
+        }
+        if (!cfg.tracePath.empty() && cfg.tracePath == base.tracePath) {
+            const std::filesystem::path trace(cfg.tracePath);
+            cfg.tracePath = (trace.parent_path() /
+                             (trace.stem().string() + "_" + std::to_string(variants.size() + 1) +
+                              trace.extension().string())).string();
+        }
+        variants.push_back(std::move(cfg));
+    }
+    if (variants.empty()) {
+        std::cerr << "Sweep file '" << base.sweepPath << "' contains no variants.\n";
+        return 1;
+    }
+
+    const int hardware = base.threads > 0 ? base.threads
+                                          : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    const int concurrent = std::min({static_cast<int>(variants.size()), 4, hardware});
+    const int threadsPerVariant = std::max(1, hardware / concurrent);
+    const bool dropPinning = base.pinThreads && concurrent > 1;
+    if (dropPinning) {
+        std::cerr << "--pin-threads is ignored in sweep mode: concurrent variants would stack on the same cores.\n";
+    }
+    for (Config& cfg : variants) {
+        cfg.threads = threadsPerVariant;
+        if (dropPinning) {
+            cfg.pinThreads = false;
+        }
+    }
+    std::cout << "Sweeping " << variants.size() << " variants, " << concurrent
+              << " at a time with " << threadsPerVariant << " threads each.\n";
+
+    std::atomic<size_t> nextVariant{0};
+    std::atomic<int> failures{0};
+    std::vector<std::thread> workers;
+    workers.reserve(concurrent);
+    for (int i = 0; i < concurrent; ++i) {
+        workers.emplace_back([&] {
+            for (;;) {
+                const size_t index = nextVariant.fetch_add(1);
+                if (index >= variants.size()) {
+                    return;
+                }
+                if (runSimulation(variants[index]) != 0) {
+                    ++failures;
+                    std::cerr << "Sweep variant " << index + 1 << " failed.\n";
+                }
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+
+    if (failures > 0) {
+        std::cerr << failures << " of " << variants.size() << " sweep variants failed.\n";
+        return 1;
+    }
+    std::cout << "Sweep complete: " << variants.size() << " variants rendered.\n";
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    Magick::InitializeMagick(nullptr);
+
+    Config cfg;
+    std::vector<std::string> args;
+    for (int i = 1; i < argc; ++i) {
+        args.emplace_back(argv[i]);
+    }
+    cfg = applyOverrides(cfg, args);
+
+    if (cfg.bench) {
+        ThreadPool benchPool(cfg.threads);
+        return runBenchmark(cfg, benchPool);
+    }
+    if (cfg.verify) {
+        return runVerify(cfg);
+    }
+    if (!cfg.decodeDeltaPath.empty()) {
+        return decodeDeltaStream(cfg.decodeDeltaPath);
+    }
+    if (!cfg.mergePaths.empty()) {
+        return mergeSegments(cfg);
+    }
+    if (!cfg.sweepPath.empty()) {
+        return runSweep(cfg);
+    }
+    return runSimulation(cfg);
 }